@@ -0,0 +1,78 @@
+/*
+* analytics.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "analytics.h"
+
+namespace RIT::MD
+{
+
+ColumnReader::ColumnReader(const uint8_t* p, const uint8_t* end, FieldSpec f, bool d)
+:
+  r{ p, end },
+  field{ f },
+  delta{ d }
+{
+}
+
+ColumnReader::ColumnReader(const BitReader& reader, FieldSpec f, bool d)
+:
+  r{ reader },
+  field{ f },
+  delta{ d }
+{
+}
+
+ColumnReader block_column(BitReader r, QuoteColumn k, BlockHeader& h)
+{
+  h = get_block_header(r);
+  if( h.layout != BlockLayout::Columnar )
+    throw std::invalid_argument("block_column needs a columnar block");
+  for( unsigned col = 0; col < unsigned(k); ++col )
+    for( size_t i = 0; i < h.n; ++i )
+      r.skip_field(kQuoteColumnSpecs[col].field);
+  const QuoteColumnSpec& s = kQuoteColumnSpecs[unsigned(k)];
+  return ColumnReader(r, s.field, s.delta);
+}
+
+void aggregate_px_sz(ColumnReader& px, ColumnReader& sz, size_t n, PxSzStats& st)
+{
+  uint64_t volume = st.volume;
+  int64_t lo = st.min_px;
+  int64_t hi = st.max_px;
+  double notional = st.notional;
+  for( size_t i = 0; i < n; ++i )
+  {
+    const int64_t p = px.next();
+    const uint64_t q = uint64_t(sz.next());
+    volume += q;
+    lo = std::min(lo, p);
+    hi = std::max(hi, p);
+    notional += double(p) * double(q);
+  }
+  st.count += n;
+  st.volume = volume;
+  st.min_px = lo;
+  st.max_px = hi;
+  st.notional = notional;
+}
+
+void volume_per_bucket(ColumnReader& ts, ColumnReader& sz, size_t n, int64_t t0, int64_t bucket, std::span<uint64_t> out)
+{
+  if( bucket <= 0 )
+    throw std::invalid_argument("bucket must be positive");
+  for( size_t i = 0; i < n; ++i )
+  {
+    const int64_t t = ts.next();
+    const uint64_t q = uint64_t(sz.next());
+    if( t < t0 )
+      continue;
+    const uint64_t b = uint64_t(t - t0) / uint64_t(bucket);
+    if( b < out.size() )
+      out[b] += q;
+  }
+}
+
+}
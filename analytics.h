@@ -0,0 +1,63 @@
+/*
+* analytics.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "block.h"
+
+namespace RIT::MD
+{
+
+// ---- one encoded column, values decoded on demand ----
+struct ColumnReader
+{
+  BitReader r;
+  FieldSpec field;
+  bool delta = false; // stored values are differences to the previous one
+  int64_t prev = 0;
+
+  ColumnReader(const uint8_t* p, const uint8_t* end, FieldSpec f, bool d = false);
+  // continues from r's bit position
+  ColumnReader(const BitReader& reader, FieldSpec f, bool d = false);
+
+  int64_t next()
+  {
+    int64_t v = r.get_field(field);
+    if( delta )
+    {
+      v = int64_t(uint64_t(prev) + uint64_t(v));
+      prev = v;
+    }
+    return v;
+  }
+};
+
+// column k of the Columnar quote block at r (header included), earlier
+// columns are skipped; h receives the header, throws for Row blocks
+ColumnReader block_column(BitReader r, QuoteColumn k, BlockHeader& h);
+
+// ---- fused decode-and-aggregate kernels ----
+// Values are decoded and folded into registers, no record or column
+// arrays are materialized.
+
+struct PxSzStats
+{
+  uint64_t count = 0;
+  uint64_t volume = 0;
+  int64_t min_px = std::numeric_limits<int64_t>::max();
+  int64_t max_px = std::numeric_limits<int64_t>::min();
+  double notional = 0; // sum px * sz
+
+  double vwap() const { return volume ? notional / double(volume) : 0.0; }
+};
+
+// n (px, sz) pairs
+void aggregate_px_sz(ColumnReader& px, ColumnReader& sz, size_t n, PxSzStats& st);
+
+// out[(ts - t0) / bucket] += sz for n (ts, sz) pairs, out of range skipped
+void volume_per_bucket(ColumnReader& ts, ColumnReader& sz, size_t n, int64_t t0, int64_t bucket, std::span<uint64_t> out);
+
+}
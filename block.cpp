@@ -0,0 +1,117 @@
+/*
+* block.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "block.h"
+
+namespace RIT::MD
+{
+
+QuoteColumns QuoteColumnBuffer::columns(size_t n)
+{
+  if( ts.size() < n )
+  {
+    ts.resize(n);
+    instr.resize(n);
+    px.resize(n);
+    sz.resize(n);
+  }
+  return QuoteColumns{ { ts.data(), n }, { instr.data(), n }, { px.data(), n }, { sz.data(), n } };
+}
+
+void put_block(BufferedBitWriter& w, const uint64_t* ts, const uint32_t* instr, const int64_t* px, const uint64_t* sz, size_t n,
+               BlockLayout layout)
+{
+  w.put_var((uint64_t(n) << 1) | uint64_t(layout));
+
+  if( layout == BlockLayout::Row )
+  {
+    uint64_t prev_ts = 0;
+    int64_t prev_px = 0;
+    for( size_t i = 0; i < n; ++i )
+    {
+      prev_ts = w.put_var(ts[i], prev_ts);
+      w.put_var(instr[i]);
+      prev_px = w.put_var_sign_zero(px[i], prev_px);
+      w.put_var_dec_zeros(sz[i]);
+    }
+    return;
+  }
+
+  uint64_t prev_ts = 0;
+  for( size_t i = 0; i < n; ++i )
+    prev_ts = w.put_var(ts[i], prev_ts);
+
+  for( size_t i = 0; i < n; ++i )
+    w.put_var(instr[i]);
+
+  int64_t prev_px = 0;
+  for( size_t i = 0; i < n; ++i )
+    prev_px = w.put_var_sign_zero(px[i], prev_px);
+
+  for( size_t i = 0; i < n; ++i )
+    w.put_var_dec_zeros(sz[i]);
+}
+
+BlockHeader get_block_header(BitReader& r)
+{
+  const uint64_t v = r.get_var64();
+  return BlockHeader{ size_t(v >> 1), BlockLayout(v & 1) };
+}
+
+void get_block_columns(BitReader& r, const BlockHeader& h, const QuoteColumns& out)
+{
+  const size_t n = h.n;
+  if( n > out.capacity() )
+    throw std::runtime_error("block exceeds column capacity");
+
+  if( h.layout == BlockLayout::Row )
+  {
+    uint64_t prev_ts = 0;
+    uint64_t prev_px = 0;
+    for( size_t i = 0; i < n; ++i )
+    {
+      out.ts[i] = prev_ts += r.get_var64();
+      out.instr[i] = r.get_var32();
+      out.px[i] = int64_t(prev_px += r.get_var64_sign_zero());
+      out.sz[i] = r.get_var64_dec_zeros();
+    }
+    return;
+  }
+
+  uint64_t* ts = out.ts.data();
+  uint64_t prev_ts = 0;
+  for( size_t i = 0; i < n; ++i )
+    ts[i] = prev_ts += r.get_var64();
+
+  uint32_t* instr = out.instr.data();
+  for( size_t i = 0; i < n; ++i )
+    instr[i] = r.get_var32();
+
+  int64_t* px = out.px.data();
+  uint64_t prev_px = 0;
+  for( size_t i = 0; i < n; ++i )
+    px[i] = int64_t(prev_px += r.get_var64_sign_zero());
+
+  uint64_t* sz = out.sz.data();
+  for( size_t i = 0; i < n; ++i )
+    sz[i] = r.get_var64_dec_zeros();
+}
+
+size_t get_block(BitReader& r, const QuoteColumns& out)
+{
+  const BlockHeader h = get_block_header(r);
+  get_block_columns(r, h, out);
+  return h.n;
+}
+
+size_t get_block(BitReader& r, QuoteColumnBuffer& buf)
+{
+  const BlockHeader h = get_block_header(r);
+  get_block_columns(r, h, buf.columns(h.n));
+  return h.n;
+}
+
+}
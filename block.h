@@ -0,0 +1,100 @@
+/*
+* block.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+
+namespace RIT::MD
+{
+
+// ---- quote block ----
+// put_var(n << 1 | layout), then n records of
+//   ts    put_var delta to previous ts (monotonic)
+//   instr put_var
+//   px    put_var_sign_zero delta to previous px
+//   sz    put_var_dec_zeros
+// either column after column (Columnar) or record after record (Row).
+// Delta state starts from 0 in every block, so blocks decode on their own.
+
+enum class BlockLayout : uint8_t
+{
+  Columnar = 0,
+  Row = 1,
+};
+
+// columns in storage order, with their encodings
+enum class QuoteColumn : uint8_t
+{
+  Ts = 0,
+  Instr = 1,
+  Px = 2,
+  Sz = 3,
+};
+
+struct QuoteColumnSpec
+{
+  FieldSpec field;
+  bool delta; // difference to the previous value
+};
+
+inline constexpr QuoteColumnSpec kQuoteColumnSpecs[4] =
+{
+  { { FieldKind::Var }, true },
+  { { FieldKind::Var }, false },
+  { { FieldKind::VarSignZero }, true },
+  { { FieldKind::DecZeros }, false },
+};
+
+struct BlockHeader
+{
+  size_t n = 0;
+  BlockLayout layout = BlockLayout::Columnar;
+};
+
+// caller-owned columns, decoded into in place
+struct QuoteColumns
+{
+  std::span<uint64_t> ts;
+  std::span<uint32_t> instr;
+  std::span<int64_t> px;
+  std::span<uint64_t> sz;
+
+  size_t capacity() const { return std::min({ ts.size(), instr.size(), px.size(), sz.size() }); }
+};
+
+// growable column storage, reused across blocks
+struct QuoteColumnBuffer
+{
+  std::vector<uint64_t> ts;
+  std::vector<uint32_t> instr;
+  std::vector<int64_t> px;
+  std::vector<uint64_t> sz;
+
+  // grows only, steady state performs no allocations
+  QuoteColumns columns(size_t n);
+};
+
+// upper bound on an encoded block of n records: 10-byte header, then
+// ts 80 + instr 40 + px 81 + sz 85 bits per record
+inline size_t max_block_bytes(size_t n)
+{
+  return 10 + (286 * n + 7) / 8;
+}
+
+void put_block(BufferedBitWriter& w, const uint64_t* ts, const uint32_t* instr, const int64_t* px, const uint64_t* sz, size_t n,
+               BlockLayout layout = BlockLayout::Columnar);
+
+BlockHeader get_block_header(BitReader& r);
+
+// body after get_block_header, throws if the columns are smaller
+void get_block_columns(BitReader& r, const BlockHeader& h, const QuoteColumns& out);
+
+// header and columns, returns the record count
+size_t get_block(BitReader& r, const QuoteColumns& out);
+size_t get_block(BitReader& r, QuoteColumnBuffer& buf);
+
+}
@@ -6,8 +6,10 @@
 
 #include "codec.h"
 #include <zstd.h>
+#include <zdict.h>
 #include <stdexcept>
 #include <cstring>
+#include <random>
 #include "common/types.h"
 
 namespace RIT::MD
@@ -75,19 +77,128 @@ void RawBufferSink::finish()
 {
 }
 
-ZstdStreamCompressor::ZstdStreamCompressor(ISink& downstream, int lvl)
+MemorySource::MemorySource(const void* p, size_t sz)
 :
-  down{ downstream },
-  cctx{ nullptr },
-  level{ lvl },
-  out_buf{}
+  data{ static_cast<const uint8_t*>(p) },
+  n{ sz }
+{
+}
+
+void MemorySource::read(uint64_t off, uint8_t* dst, size_t cnt)
+{
+  if( off > n || cnt > n - off )
+    throw std::runtime_error("MemorySource read out of range");
+  std::memcpy(dst, data + off, cnt);
+}
+
+IStreamSource::IStreamSource(std::istream& s)
+:
+  is{ s }
+{
+}
+
+uint64_t IStreamSource::size()
+{
+  is.clear();
+  is.seekg(0, std::ios::end);
+  const std::streamoff sz = is.tellg();
+  if( sz < 0 )
+    throw std::runtime_error("IStreamSource size failed");
+  return uint64_t(sz);
+}
+
+void IStreamSource::read(uint64_t off, uint8_t* dst, size_t cnt)
+{
+  is.clear();
+  is.seekg((std::streamoff)off);
+  is.read(reinterpret_cast<char*>(dst), (std::streamsize)cnt);
+  if( (size_t)is.gcount() != cnt )
+    throw std::runtime_error("IStreamSource short read");
+}
+
+ZstdDictionary::ZstdDictionary(const uint8_t* data, size_t n, int level)
+:
+  bytes(data, data + n)
+{
+  cdict = ZSTD_createCDict(bytes.data(), bytes.size(), level);
+  ddict = ZSTD_createDDict(bytes.data(), bytes.size());
+  if( !cdict || !ddict )
+  {
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeDDict(ddict);
+    throw std::runtime_error("ZSTD_createCDict/DDict failed");
+  }
+  id = ZSTD_getDictID_fromDict(bytes.data(), bytes.size());
+}
+
+ZstdDictionary::~ZstdDictionary()
+{
+  ZSTD_freeCDict(cdict);
+  ZSTD_freeDDict(ddict);
+}
+
+ZstdDictionary ZstdDictionary::train(const std::vector<std::vector<uint8_t>>& samples, size_t capacity, int level)
+{
+  std::vector<uint8_t> flat;
+  std::vector<size_t> sizes;
+  sizes.reserve(samples.size());
+  for( const std::vector<uint8_t>& s : samples )
+  {
+    flat.insert(flat.end(), s.begin(), s.end());
+    sizes.push_back(s.size());
+  }
+
+  std::vector<uint8_t> dict(capacity);
+  const size_t n = ZDICT_trainFromBuffer(dict.data(), dict.size(), flat.data(), sizes.data(), unsigned(sizes.size()));
+  if( ZDICT_isError(n) )
+    throw std::runtime_error(ZDICT_getErrorName(n));
+  return ZstdDictionary(dict.data(), n, level);
+}
+
+ZSTD_CCtx* create_cctx(int level)
 {
-  cctx = ZSTD_createCCtx();
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
   if( !cctx )
     throw std::runtime_error("ZSTD_createCCtx failed");
   size_t rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
   if( ZSTD_isError(rc) )
+  {
+    ZSTD_freeCCtx(cctx);
     throw std::runtime_error(ZSTD_getErrorName(rc));
+  }
+  return cctx;
+}
+
+ZstdStreamCompressor::ZstdStreamCompressor(ISink& downstream, int lvl, size_t out_cap)
+:
+  down{ &downstream },
+  cctx{ nullptr },
+  level{ lvl },
+  owned{ new uint8_t[out_cap] },
+  out_buf{ owned.get(), out_cap }
+{
+  if( out_buf.empty() )
+    throw std::invalid_argument("ZstdStreamCompressor empty buffer");
+  cctx = create_cctx(level);
+}
+
+ZstdStreamCompressor::ZstdStreamCompressor(ISink& downstream, int lvl, std::span<uint8_t> out)
+:
+  down{ &downstream },
+  cctx{ nullptr },
+  level{ lvl },
+  out_buf{ out }
+{
+  if( out_buf.empty() )
+    throw std::invalid_argument("ZstdStreamCompressor empty buffer");
+  cctx = create_cctx(level);
+}
+
+ZstdStreamCompressor::ZstdStreamCompressor(ISink& downstream, const ZstdParams& p, size_t out_cap)
+:
+  ZstdStreamCompressor(downstream, p.level, out_cap)
+{
+  set_params(p);
 }
 
 ZstdStreamCompressor::~ZstdStreamCompressor()
@@ -96,6 +207,63 @@ ZstdStreamCompressor::~ZstdStreamCompressor()
     ZSTD_freeCCtx(cctx);
 }
 
+void ZstdStreamCompressor::set_params(const ZstdParams& p)
+{
+  const std::pair<ZSTD_cParameter, int> params[] =
+  {
+    { ZSTD_c_compressionLevel, p.level },
+    { ZSTD_c_strategy, int(p.strategy) },
+    { ZSTD_c_windowLog, p.window_log },
+    { ZSTD_c_enableLongDistanceMatching, p.long_distance ? 1 : 0 },
+#if ZSTD_VERSION_NUMBER >= 10506
+    // stable API from 1.5.6, skipped with older libzstd
+    { ZSTD_c_targetCBlockSize, int(p.target_cblock_size) },
+#endif
+  };
+  for( const auto& [param, v] : params )
+  {
+    size_t rc = ZSTD_CCtx_setParameter(cctx, param, v);
+    if( ZSTD_isError(rc) )
+      throw std::runtime_error(ZSTD_getErrorName(rc));
+  }
+  level = p.level;
+}
+
+void ZstdStreamCompressor::rebind(ISink& downstream, const ZstdParams& p)
+{
+  rebind(downstream, p.level);
+  set_params(p);
+}
+
+void ZstdStreamCompressor::rebind(ISink& downstream, int lvl)
+{
+  size_t rc = ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+  rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, lvl);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+  down = &downstream;
+  level = lvl;
+}
+
+void ZstdStreamCompressor::use_dictionary(const ZstdDictionary& d)
+{
+  size_t rc = ZSTD_CCtx_refCDict(cctx, d.cdict);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+  rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 1);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+}
+
+void ZstdStreamCompressor::ref_prefix(const uint8_t* p, size_t n)
+{
+  size_t rc = ZSTD_CCtx_refPrefix(cctx, p, n);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+}
+
 void ZstdStreamCompressor::write(const uint8_t* data, size_t n)
 {
   ZSTD_inBuffer inb{ data, n, 0 };
@@ -106,7 +274,7 @@ void ZstdStreamCompressor::write(const uint8_t* data, size_t n)
     if( ZSTD_isError(rc) )
       throw std::runtime_error(ZSTD_getErrorName(rc));
     if( outb.pos )
-      down.write(out_buf.data(), outb.pos);
+      down->write(out_buf.data(), outb.pos);
     if( inb.pos == inb.size && outb.pos < outb.size )
       break;
   }
@@ -122,11 +290,11 @@ void ZstdStreamCompressor::flush()
     if( ZSTD_isError(rc) )
       throw std::runtime_error(ZSTD_getErrorName(rc));
     if( outb.pos )
-      down.write(out_buf.data(), outb.pos);
+      down->write(out_buf.data(), outb.pos);
     if( outb.pos < outb.size )
       break;
   }
-  down.flush();
+  down->flush();
 }
 
 void ZstdStreamCompressor::finish()
@@ -139,17 +307,89 @@ void ZstdStreamCompressor::finish()
     if( ZSTD_isError(rc) )
       throw std::runtime_error(ZSTD_getErrorName(rc));
     if( outb.pos )
-      down.write(out_buf.data(), outb.pos);
+      down->write(out_buf.data(), outb.pos);
     if( rc == 0 )
       break;
   }
-  down.finish();
+  down->finish();
+}
+
+ZstdStreamDecompressor::ZstdStreamDecompressor(ISink& downstream, size_t out_cap)
+:
+  down{ &downstream },
+  dctx{ nullptr },
+  owned{ new uint8_t[out_cap] },
+  out_buf{ owned.get(), out_cap }
+{
+  if( out_buf.empty() )
+    throw std::invalid_argument("ZstdStreamDecompressor empty buffer");
+  dctx = ZSTD_createDCtx();
+  if( !dctx )
+    throw std::runtime_error("ZSTD_createDCtx failed");
+}
+
+ZstdStreamDecompressor::~ZstdStreamDecompressor()
+{
+  if( dctx )
+    ZSTD_freeDCtx(dctx);
+}
+
+void ZstdStreamDecompressor::use_dictionary(const ZstdDictionary& d)
+{
+  size_t rc = ZSTD_DCtx_refDDict(dctx, d.ddict);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+}
+
+void ZstdStreamDecompressor::write(const uint8_t* data, size_t n)
+{
+  ZSTD_inBuffer inb{ data, n, 0 };
+  for( ;; )
+  {
+    ZSTD_outBuffer outb{ out_buf.data(), out_buf.size(), 0 };
+    size_t rc = ZSTD_decompressStream(dctx, &outb, &inb);
+    if( ZSTD_isError(rc) )
+      throw std::runtime_error(ZSTD_getErrorName(rc));
+    if( inb.pos )
+      in_frame = rc != 0;
+    if( outb.pos )
+      down->write(out_buf.data(), outb.pos);
+    if( inb.pos == inb.size && outb.pos < outb.size )
+      break;
+  }
+}
+
+void ZstdStreamDecompressor::flush()
+{
+  down->flush();
+}
+
+void ZstdStreamDecompressor::finish()
+{
+  if( in_frame )
+    throw std::runtime_error("zstd truncated frame");
+  down->finish();
+}
+
+BufferedBitWriter::BufferedBitWriter(ISink& s, size_t capacity)
+:
+  sink{ &s },
+  owned{ new uint8_t[capacity] },
+  buf{ owned.get() },
+  cap{ capacity }
+{
+  if( !cap )
+    throw std::invalid_argument("BufferedBitWriter empty buffer");
 }
 
-BufferedBitWriter::BufferedBitWriter(ISink& s)
+BufferedBitWriter::BufferedBitWriter(ISink& s, std::span<uint8_t> storage)
 :
-  sink{ s }
+  sink{ &s },
+  buf{ storage.data() },
+  cap{ storage.size() }
 {
+  if( !cap )
+    throw std::invalid_argument("BufferedBitWriter empty buffer");
 }
 
 BitReader::BitReader(const uint8_t* p_, const uint8_t* end_)
@@ -162,5 +402,625 @@ static int reg3 = add_test( []()
 {
 } );
 
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
 }
 
+// 64-bit field skipped at every offset near the tail, where a byte-wise
+// refill can leave bits == 64
+static int reg4 = add_test( []()
+{
+  for( unsigned lead = 0; lead < 80; ++lead )
+  {
+    std::vector<uint8_t> v;
+    VectorSink vs(v);
+    BufferedBitWriter w(vs, 64);
+    w.put(0x5A5A5A5A5A5A5A5Aull, lead);
+    w.put(0xFEDCBA9876543210ull, 64);
+    w.put(0xA5, 8);
+    w.finish();
+
+    for( unsigned pre = 0; pre <= lead; pre += 8 )
+    {
+      BitReader r(v.data(), v.data() + v.size());
+      r.get(pre);
+      r.skip_bits(lead - pre);
+      r.refill();
+      r.skip_field(FieldSpec{ FieldKind::Bits, 64 });
+      expect(r.get(8) == 0xA5, "skip_bits 64 at tail");
+    }
+  }
+} );
+
+// random value of random bit length, zero one time in eight
+static uint64_t rnd_value(std::mt19937_64& g, unsigned max_bits = 64)
+{
+  if( g() % 8 == 0 )
+    return 0;
+  const unsigned nb = 1 + unsigned(g() % max_bits);
+  return g() >> (64 - nb);
+}
+
+// splice of a stream of every length at every writer offset equals
+// writing its values serially
+static int reg5 = add_test( []()
+{
+  std::mt19937_64 g(64);
+  for( unsigned off = 0; off < 64; ++off )
+  {
+    for( unsigned rep = 0; rep < 4; ++rep )
+    {
+      std::vector<std::pair<uint64_t, unsigned>> vals;
+      const size_t nv = g() % 40;
+      for( size_t i = 0; i < nv; ++i )
+      {
+        const unsigned b = unsigned(g() % 65);
+        vals.emplace_back(g(), b);
+      }
+      const uint64_t lead = g();
+      const uint64_t tail = g();
+
+      std::vector<uint8_t> serial, part, spliced;
+      VectorSink ss(serial), ps(part), cs(spliced);
+      BufferedBitWriter ws(ss, 16), wp(ps, 16), wc(cs, 16);
+      ws.put(lead, off);
+      wc.put(lead, off);
+      for( const auto& [v, b] : vals )
+      {
+        ws.put(v, b);
+        wp.put(v, b);
+      }
+      ws.put(tail, 13);
+      const uint64_t nbits = wp.bits_written();
+      wp.finish();
+      wc.splice(part.data(), nbits);
+      expect(wc.bits_written() == off + nbits, "splice bits_written");
+      wc.put(tail, 13);
+      ws.finish();
+      wc.finish();
+      expect(serial == spliced, "splice vs serial");
+    }
+  }
+} );
+
+// one call of every put_* per step, same sequence for any writer type
+template<typename W>
+static void put_mix(W& w, std::mt19937_64& g)
+{
+  const uint64_t v = rnd_value(g);
+  switch( g() % 16 )
+  {
+    case 0: w.put(v, unsigned(g() % 65)); break;
+    case 1: w.put_var(v); break;
+    case 2: w.put_var(uint32_t(v)); break;
+    case 3: w.put_var_zero(v); break;
+    case 4: w.put_var_sign_zero(int64_t(v)); break;
+    case 5: w.put_var_dec_zeros(v % 1000 * POW10[g() % 16]); break;
+    case 6: w.put_var_sign_dec_zeros(-int64_t(v % 1000 * POW10[g() % 16])); break;
+#ifdef __SIZEOF_INT128__
+    case 7: w.put_var((uint128_t(rnd_value(g)) << (g() % 64)) | v); break;
+    case 8: w.put128(uint128_t(v) << 40, unsigned(g() % 129)); break;
+    case 9: w.put_var128_sign_zero(-(int128_t(v) << (g() % 60))); break;
+#endif
+    case 10:
+    {
+      uint8_t b[19];
+      for( uint8_t& x : b )
+        x = uint8_t(g());
+      w.put_bytes(b, g() % sizeof(b));
+      break;
+    }
+    case 11:
+    {
+      uint8_t b[19];
+      for( uint8_t& x : b )
+        x = uint8_t(g());
+      w.splice(b, g() % (8 * sizeof(b)));
+      break;
+    }
+    case 12: w.align_to_byte(); break;
+    case 13: w.put_presence(v & 0x7F, 7); break;
+    case 14: w.put_var(v >> 1, v >> 2); break;
+    default: w.put_var_sign_zero(int64_t(v >> 2), int64_t(v >> 3)); break;
+  }
+}
+
+// SizeEstimator counts exactly the bits the writer emits
+static int reg6 = add_test( []()
+{
+  std::vector<uint8_t> out;
+  VectorSink vs(out);
+  BufferedBitWriter w(vs, 1024);
+  SizeEstimator e;
+  std::mt19937_64 gw(68), ge(68);
+  for( unsigned i = 0; i < 100000; ++i )
+  {
+    put_mix(w, gw);
+    put_mix(e, ge);
+    expect(w.bits_written() == e.bits_written(), "SizeEstimator bits");
+  }
+  w.finish();
+  e.finish();
+  expect(out.size() == e.bytes(), "SizeEstimator bytes");
+} );
+
+// SpanBitWriter output is byte-identical to BufferedBitWriter's, checked
+// mode throws when the span is one byte short
+static int reg7 = add_test( []()
+{
+  for( uint64_t seed = 0; seed < 32; ++seed )
+  {
+    std::vector<uint8_t> ref;
+    VectorSink vs(ref);
+    BufferedBitWriter w(vs, 256);
+    std::mt19937_64 g(seed);
+    for( unsigned i = 0; i < 500; ++i )
+      put_mix(w, g);
+    w.finish();
+
+    std::vector<uint8_t> a(ref.size()), b(ref.size());
+    SpanBitWriter<true> sa{ std::span<uint8_t>(a) };
+    SpanBitWriter<false> sb{ std::span<uint8_t>(b) };
+    std::mt19937_64 ga(seed), gb(seed);
+    for( unsigned i = 0; i < 500; ++i )
+    {
+      put_mix(sa, ga);
+      put_mix(sb, gb);
+    }
+    expect(sa.finish() == ref.size() && a == ref, "SpanBitWriter checked");
+    expect(sb.finish() == ref.size() && b == ref, "SpanBitWriter unchecked");
+
+    if( ref.empty() )
+      continue;
+    std::vector<uint8_t> c(ref.size() - 1);
+    SpanBitWriter<true> sc{ std::span<uint8_t>(c) };
+    std::mt19937_64 gc(seed);
+    bool threw = false;
+    try
+    {
+      for( unsigned i = 0; i < 500; ++i )
+        put_mix(sc, gc);
+      sc.finish();
+    }
+    catch( const std::length_error& )
+    {
+      threw = true;
+    }
+    expect(threw, "SpanBitWriter overflow");
+  }
+} );
+
+// get_var32 family round-trips every width at every bit offset, and
+// rejects varints that do not fit 32 bits
+static int reg8 = add_test( []()
+{
+  std::mt19937_64 g(54);
+  std::vector<uint64_t> vals;
+  std::vector<uint8_t> out;
+  VectorSink vs(out);
+  BufferedBitWriter w(vs, 512);
+  for( unsigned i = 0; i < 20000; ++i )
+  {
+    const uint64_t v = rnd_value(g, 32);
+    vals.push_back(v);
+    w.put(v, i % 11);
+    switch( i % 5 )
+    {
+      case 0: w.put_var(uint32_t(v)); break;
+      case 1: w.put_var_zero(v); break;
+      case 2: w.put_var_sign_zero(int32_t(v)); break;
+      case 3: w.put_var_dec_zeros(v % 100000 * POW10[i % 6]); break;
+      default: w.put_var_sign_dec_zeros(-int64_t(v % 100000 * POW10[i % 6])); break;
+    }
+  }
+  w.finish();
+
+  BitReader r(out.data(), out.data() + out.size());
+  for( unsigned i = 0; i < vals.size(); ++i )
+  {
+    const uint64_t v = vals[i];
+    expect(r.get(i % 11) == (v & ((1ull << (i % 11)) - 1)), "get_var32 lead");
+    switch( i % 5 )
+    {
+      case 0: expect(r.get_var32() == uint32_t(v), "get_var32"); break;
+      case 1: expect(r.get_var32_zero() == uint32_t(v), "get_var32_zero"); break;
+      case 2: expect(r.get_var32_sign_zero() == int32_t(v), "get_var32_sign_zero"); break;
+      case 3: expect(r.get_var32_dec_zeros() == v % 100000 * POW10[i % 6], "get_var32_dec_zeros"); break;
+      default: expect(r.get_var32_sign_dec_zeros() == -int64_t(v % 100000 * POW10[i % 6]), "get_var32_sign_dec_zeros"); break;
+    }
+  }
+
+  for( const uint64_t big : { uint64_t(1) << 32, ~uint64_t(0) } )
+  {
+    std::vector<uint8_t> o;
+    VectorSink os(o);
+    BufferedBitWriter bw(os, 64);
+    bw.put_var(big);
+    bw.put(0, 64);
+    bw.finish();
+    BitReader br(o.data(), o.data() + o.size());
+    bool threw = false;
+    try
+    {
+      br.get_var32();
+    }
+    catch( const std::runtime_error& )
+    {
+      threw = true;
+    }
+    expect(threw, "get_var32 overlong");
+  }
+} );
+
+// peek-based get_var64 and flagged decoders over every value width and
+// bit offset, near the tail too
+static int reg9 = add_test( []()
+{
+  for( uint64_t seed = 0; seed < 16; ++seed )
+  {
+    std::mt19937_64 g(55 + seed);
+    std::vector<uint64_t> vals;
+    std::vector<uint8_t> out;
+    VectorSink vs(out);
+    BufferedBitWriter w(vs, 512);
+    const unsigned n = 1 + unsigned(g() % 3000);
+    for( unsigned i = 0; i < n; ++i )
+    {
+      const uint64_t v = rnd_value(g);
+      vals.push_back(v);
+      w.put(v, i % 13);
+      switch( i % 5 )
+      {
+        case 0: w.put_var(v); break;
+        case 1: w.put_var_zero(v); break;
+        case 2: w.put_var_sign_zero(int64_t(v)); break;
+        case 3: w.put_var_dec_zeros(v % 10000000 * POW10[i % 12]); break;
+        default: w.put_var_sign_dec_zeros(-int64_t(v % 10000000 * POW10[i % 12])); break;
+      }
+    }
+    w.finish();
+
+    BitReader r(out.data(), out.data() + out.size());
+    for( unsigned i = 0; i < n; ++i )
+    {
+      const uint64_t v = vals[i];
+      expect(r.get(i % 13) == (v & ((1ull << (i % 13)) - 1)), "get_var64 lead");
+      switch( i % 5 )
+      {
+        case 0: expect(r.get_var64() == v, "get_var64"); break;
+        case 1: expect(r.get_var64_zero() == v, "get_var64_zero"); break;
+        case 2: expect(r.get_var64_sign_zero() == uint64_t(int64_t(v)), "get_var64_sign_zero"); break;
+        case 3: expect(r.get_var64_dec_zeros() == v % 10000000 * POW10[i % 12], "get_var64_dec_zeros"); break;
+        default: expect(r.get_var64_sign_dec_zeros() == -int64_t(v % 10000000 * POW10[i % 12]), "get_var64_sign_dec_zeros"); break;
+      }
+    }
+  }
+} );
+
+// skipping every other field of a random schema lands on the same
+// values a full decode reads
+static int reg10 = add_test( []()
+{
+  static constexpr FieldSpec kSchema[] =
+  {
+    { FieldKind::Bits, 13 },
+    { FieldKind::Var },
+    { FieldKind::VarZero },
+    { FieldKind::VarSignZero },
+    { FieldKind::DecZeros },
+    { FieldKind::SignDecZeros },
+    { FieldKind::Bits, 64 },
+    { FieldKind::Var },
+  };
+  static constexpr unsigned kFields = sizeof(kSchema) / sizeof(kSchema[0]);
+
+  std::mt19937_64 g(56);
+  std::vector<uint8_t> out;
+  VectorSink vs(out);
+  BufferedBitWriter w(vs, 512);
+  const unsigned nrec = 5000;
+  for( unsigned i = 0; i < nrec; ++i )
+  {
+    const uint64_t mask = g() & ((1u << kFields) - 1);
+    w.put_presence(mask, kFields);
+    for( unsigned f = 0; f < kFields; ++f )
+    {
+      if( !(mask >> f & 1) )
+        continue;
+      const uint64_t v = rnd_value(g);
+      switch( kSchema[f].kind )
+      {
+        case FieldKind::Bits: w.put(v, kSchema[f].width); break;
+        case FieldKind::Var: w.put_var(v); break;
+        case FieldKind::VarZero: w.put_var_zero(v); break;
+        case FieldKind::VarSignZero: w.put_var_sign_zero(int64_t(v)); break;
+        case FieldKind::DecZeros: w.put_var_dec_zeros(v % 1000 * POW10[v % 16]); break;
+        case FieldKind::SignDecZeros: w.put_var_sign_dec_zeros(int64_t(v % 1000 * POW10[v % 16])); break;
+      }
+    }
+  }
+  w.finish();
+
+  BitReader full(out.data(), out.data() + out.size());
+  BitReader skip(out.data(), out.data() + out.size());
+  BitReader whole(out.data(), out.data() + out.size());
+  for( unsigned i = 0; i < nrec; ++i )
+  {
+    const uint64_t mask = full.get_presence(kFields);
+    expect(skip.get_presence(kFields) == mask, "skip presence");
+    unsigned nth = 0;
+    for( unsigned f = 0; f < kFields; ++f )
+    {
+      if( !(mask >> f & 1) )
+        continue;
+      const int64_t v = full.get_field(kSchema[f]);
+      if( (i + nth++) & 1 )
+        skip.skip_field(kSchema[f]);
+      else
+        expect(skip.get_field(kSchema[f]) == v, "skip_field");
+    }
+    whole.skip_present(kSchema, kFields);
+  }
+  const auto at = [&](const BitReader& r) { return uint64_t(r.p - out.data()) * 8 - r.bits; };
+  expect(at(full) == at(skip), "skip position");
+  expect(at(full) == at(whole), "skip_present position");
+} );
+
+// decompressor accepts empty input and whole frames, rejects a cut frame
+static int reg11 = add_test( []()
+{
+  std::vector<uint8_t> raw(5000);
+  std::mt19937_64 g(73);
+  for( uint8_t& b : raw )
+    b = uint8_t(g() % 7);
+  std::vector<uint8_t> z;
+  VectorSink zs(z);
+  ZstdStreamCompressor c(zs);
+  c.write(raw.data(), raw.size());
+  c.finish();
+
+  for( size_t cut : { size_t(0), z.size() - 1, z.size() } )
+  {
+    std::vector<uint8_t> out;
+    VectorSink os(out);
+    ZstdStreamDecompressor d(os);
+    d.write(z.data(), 0);
+    d.write(z.data(), cut);
+    d.write(z.data() + cut, 0);
+    bool threw = false;
+    try
+    {
+      d.finish();
+    }
+    catch( const std::runtime_error& )
+    {
+      threw = true;
+    }
+    const bool whole = cut == 0 || cut == z.size();
+    expect(threw != whole, "ZstdStreamDecompressor truncation");
+    if( cut == z.size() )
+      expect(out == raw, "ZstdStreamDecompressor round-trip");
+  }
+} );
+
+// rollback restores the exact bytes, refuses to cross a spill, and a
+// pinned overrun throws yet still rolls back
+static int reg13 = add_test( []()
+{
+  std::mt19937_64 g(66);
+  for( unsigned lead = 0; lead < 16; ++lead )
+  {
+    std::vector<uint8_t> ref, out;
+    VectorSink rs(ref), os(out);
+    BufferedBitWriter r(rs, 256), w(os, 256);
+    std::mt19937_64 gr(lead), gw(lead);
+    r.put(0x5A5A, lead);
+    w.put(0x5A5A, lead);
+    for( unsigned step = 0; step < 200; ++step )
+    {
+      w.pin(128);
+      const BufferedBitWriter::Checkpoint cp = w.checkpoint();
+      for( unsigned i = 0; i < 1 + g() % 4; ++i )
+        put_mix(w, g);
+      w.rollback(cp);
+      w.unpin();
+      expect(w.bits_written() == r.bits_written(), "rollback bits_written");
+      put_mix(r, gr);
+      put_mix(w, gw);
+    }
+    r.finish();
+    w.finish();
+    expect(out == ref, "rollback bytes");
+  }
+
+  {
+    std::vector<uint8_t> out;
+    VectorSink os(out);
+    BufferedBitWriter w(os, 16);
+    w.put(1, 3);
+    const BufferedBitWriter::Checkpoint cp = w.checkpoint();
+    for( unsigned i = 0; i < 40; ++i )
+      w.put(i, 8);
+    bool threw = false;
+    try
+    {
+      w.rollback(cp);
+    }
+    catch( const std::logic_error& )
+    {
+      threw = true;
+    }
+    expect(threw, "rollback across a spill");
+  }
+
+  {
+    std::vector<uint8_t> ref, out;
+    VectorSink rs(ref), os(out);
+    BufferedBitWriter r(rs, 64), w(os, 64);
+    r.put(0x1234, 13);
+    w.put(0x1234, 13);
+    w.pin(16);
+    const BufferedBitWriter::Checkpoint cp = w.checkpoint();
+    bool threw = false;
+    try
+    {
+      for( unsigned i = 0; i < 100; ++i )
+        w.put(i, 8);
+    }
+    catch( const std::length_error& )
+    {
+      threw = true;
+    }
+    expect(threw && out.empty(), "pinned overrun");
+    w.rollback(cp);
+    w.unpin();
+    for( unsigned i = 0; i < 100; ++i )
+    {
+      r.put(~i, 8);
+      w.put(~i, 8);
+    }
+    r.finish();
+    w.finish();
+    expect(out == ref, "rollback after pinned overrun");
+  }
+} );
+
+struct PresenceRec
+{
+  std::array<uint64_t, 64> f{};
+};
+
+// odd fields are varints, field i even is a fixed i + 1 bits
+template<size_t I>
+static void put_presence_field(BufferedBitWriter& w, const PresenceRec& rec)
+{
+  if constexpr( I & 1 )
+    w.put_var(rec.f[I]);
+  else
+    w.put(rec.f[I], unsigned(I + 1));
+}
+
+template<size_t I>
+static void get_presence_field(BitReader& r, PresenceRec& rec)
+{
+  if constexpr( I & 1 )
+    rec.f[I] = r.get_var64();
+  else
+    rec.f[I] = r.get(unsigned(I + 1));
+}
+
+template<size_t... I>
+static constexpr std::array<FieldEncoder<PresenceRec>, 64> presence_encoders(std::index_sequence<I...>)
+{
+  return { &put_presence_field<I>... };
+}
+
+template<size_t... I>
+static constexpr std::array<FieldDecoder<PresenceRec>, 64> presence_decoders(std::index_sequence<I...>)
+{
+  return { &get_presence_field<I>... };
+}
+
+// encode_present/decode_present round trip after a 5-bit prefix, with
+// sparse, full 64-field and random masks
+static int reg14 = add_test( []()
+{
+  static constexpr auto kEnc = presence_encoders(std::make_index_sequence<64>{});
+  static constexpr auto kDec = presence_decoders(std::make_index_sequence<64>{});
+  std::mt19937_64 g(51);
+  std::vector<PresenceRec> recs(300);
+  std::vector<uint64_t> masks;
+  std::vector<uint8_t> out;
+  VectorSink vs(out);
+  BufferedBitWriter w(vs, 512);
+  w.put(0x15, 5);
+  for( size_t i = 0; i < recs.size(); ++i )
+  {
+    uint64_t m = i % 3 == 0 ? (uint64_t(1) << (g() % 64)) | (uint64_t(1) << (g() % 64))
+               : i % 3 == 1 ? ~uint64_t(0)
+               : g();
+    PresenceRec& rec = recs[i];
+    for( size_t f = 0; f < 64; ++f )
+      rec.f[f] = m >> f & 1 ? ((f & 1) ? rnd_value(g) : g() & (~uint64_t(0) >> (63 - f))) : 0;
+    encode_present(w, m, 64, kEnc.data(), rec);
+    masks.push_back(m);
+  }
+  w.finish();
+
+  BitReader r(out.data(), out.data() + out.size());
+  expect(r.get(5) == 0x15, "presence prefix");
+  for( size_t i = 0; i < recs.size(); ++i )
+  {
+    PresenceRec rec;
+    expect(decode_present(r, 64, kDec.data(), rec) == masks[i], "decode_present mask");
+    expect(rec.f == recs[i].f, "decode_present fields");
+  }
+} );
+
+#ifdef __SIZEOF_INT128__
+// 128-bit values of every width at random bit offsets read back through
+// get128 and the get_var128 family, negative values included
+static int reg12 = add_test( []()
+{
+  std::mt19937_64 g(53);
+  const auto rnd128 = [&]() -> uint128_t
+  {
+    const unsigned w = unsigned(g() % 129);
+    const uint128_t v = uint128_t(g()) << 64 | g();
+    return w ? v >> (128 - w) : 0;
+  };
+
+  struct Op
+  {
+    unsigned kind;
+    unsigned b;
+    uint128_t v;
+  };
+  std::vector<Op> ops;
+  std::vector<uint8_t> out;
+  VectorSink vs(out);
+  BufferedBitWriter w(vs, 256);
+  for( unsigned i = 0; i < 20000; ++i )
+  {
+    Op op{ unsigned(g() % 5), unsigned(g() % 129), rnd128() };
+    switch( op.kind )
+    {
+      case 0:
+        op.b %= 57;
+        op.v &= (uint128_t(1) << op.b) - 1;
+        w.put(uint64_t(op.v), op.b);
+        break;
+      case 1:
+        op.v &= op.b == 128 ? ~uint128_t(0) : (uint128_t(1) << op.b) - 1;
+        w.put128(op.v, op.b);
+        break;
+      case 2: w.put_var(op.v); break;
+      case 3: w.put_var128_zero(op.v); break;
+      default:
+        if( g() & 1 )
+          op.v = uint128_t(-int128_t(op.v >> 1));
+        w.put_var128_sign_zero(int128_t(op.v));
+        break;
+    }
+    ops.push_back(op);
+  }
+  w.finish();
+
+  BitReader r(out.data(), out.data() + out.size());
+  for( const Op& op : ops )
+  {
+    switch( op.kind )
+    {
+      case 0: expect(r.get(op.b) == uint64_t(op.v), "get"); break;
+      case 1: expect(r.get128(op.b) == op.v, "get128"); break;
+      case 2: expect(r.get_var128() == op.v, "get_var128"); break;
+      case 3: expect(r.get_var128_zero() == op.v, "get_var128_zero"); break;
+      default: expect(r.get_var128_sign_zero() == int128_t(op.v), "get_var128_sign_zero"); break;
+    }
+  }
+} );
+#endif
+
+}
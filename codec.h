@@ -15,10 +15,20 @@
 #include <string>
 #include <array>
 #include <ostream>
+#include <istream>
 #include <cassert>
+#include <memory>
+#include <span>
+#include <utility>
 
 struct ZSTD_CCtx_s;
 typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+struct ZSTD_DCtx_s;
+typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+struct ZSTD_CDict_s;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+struct ZSTD_DDict_s;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
 
 namespace RIT::MD
 {
@@ -63,23 +73,147 @@ struct RawBufferSink final : ISink
   size_t size() const { return pos; }
 };
 
+// new context at `level`, throws on failure (nothing leaks); release with
+// ZSTD_freeCCtx
+ZSTD_CCtx* create_cctx(int level);
+
+// trained or loaded zstd dictionary, digested once and shared read-only
+// by any number of compressors and decompressors
+struct ZstdDictionary
+{
+  std::vector<uint8_t> bytes;
+  ZSTD_CDict* cdict = nullptr;
+  ZSTD_DDict* ddict = nullptr;
+  uint32_t id = 0; // written to every frame header, 0 for raw content
+
+  ZstdDictionary(const uint8_t* data, size_t n, int level = 3);
+  ~ZstdDictionary();
+  ZstdDictionary(const ZstdDictionary&) = delete;
+  ZstdDictionary& operator=(const ZstdDictionary&) = delete;
+
+  // ZDICT_trainFromBuffer over sample encodes, e.g. small blocks
+  static ZstdDictionary train(const std::vector<std::vector<uint8_t>>& samples, size_t capacity = 16 * 1024, int level = 3);
+};
+
+// mirrors ZSTD_strategy, Default keeps the level's choice
+enum class ZstdStrategy : int
+{
+  Default = 0,
+  Fast = 1,
+  DFast = 2,
+  Greedy = 3,
+  Lazy = 4,
+  Lazy2 = 5,
+  BtLazy2 = 6,
+  BtOpt = 7,
+  BtUltra = 8,
+  BtUltra2 = 9,
+};
+
+// compression parameters, zero means the level's default
+struct ZstdParams
+{
+  int level = 3;
+  ZstdStrategy strategy = ZstdStrategy::Default;
+  int window_log = 0;
+  size_t target_cblock_size = 0; // compressed block target, >= 1340, needs zstd 1.5.6
+  bool long_distance = false; // false leaves it to zstd
+
+  // small blocks that fit a packet and a 256 KiB window, fastest strategy
+  static ZstdParams live() { return { 1, ZstdStrategy::Fast, 18, 1340, false }; }
+  static ZstdParams balanced() { return { 3 }; }
+  // strong level, 128 MiB window with long distance matching
+  static ZstdParams archive() { return { 19, ZstdStrategy::Default, 27, 0, true }; }
+};
+
 struct ZstdStreamCompressor final : ISink
 {
-  static constexpr size_t kOutCap = 128 * 1024;
+  static constexpr size_t kOutCap = 128 * 1024; // default output buffer
 
-  ISink& down;
+  ISink* down;
   ZSTD_CCtx* cctx = nullptr;
   int level = 3;
-  std::array<uint8_t, kOutCap> out_buf{};
+  std::unique_ptr<uint8_t[]> owned;
+  std::span<uint8_t> out_buf;
 
-  explicit ZstdStreamCompressor(ISink& downstream, int lvl = 3);
+  explicit ZstdStreamCompressor(ISink& downstream, int lvl = 3, size_t out_cap = kOutCap);
+  // caller-owned output buffer, must outlive the compressor
+  ZstdStreamCompressor(ISink& downstream, int lvl, std::span<uint8_t> out);
+  ZstdStreamCompressor(ISink& downstream, const ZstdParams& p, size_t out_cap = kOutCap);
   ~ZstdStreamCompressor() override;
 
+  // between frames only
+  void set_params(const ZstdParams& p);
+
+  // starts over on a new sink, keeping the context and its workspace
+  // (ZSTD_CCtx_reset), any unfinished frame is dropped
+  void rebind(ISink& downstream, int lvl = 3);
+  void rebind(ISink& downstream, const ZstdParams& p);
+
+  // frames from here on use d (and its level) and record its id, until
+  // rebind; d must outlive the use
+  void use_dictionary(const ZstdDictionary& d);
+
+  // next frame only: matches may reference p[0..n), which must stay
+  // valid and unchanged until that frame ends; call between frames
+  void ref_prefix(const uint8_t* p, size_t n);
+
   void write(const uint8_t* data, size_t n) override; // compress block
   void flush() override; // zstd flush
   void finish() override; // end frame
 };
 
+// streaming inverse of ZstdStreamCompressor: compressed bytes in,
+// decompressed bytes to down
+struct ZstdStreamDecompressor final : ISink
+{
+  static constexpr size_t kOutCap = 128 * 1024;
+
+  ISink* down;
+  ZSTD_DCtx* dctx = nullptr;
+  std::unique_ptr<uint8_t[]> owned;
+  std::span<uint8_t> out_buf;
+  bool in_frame = false; // a frame was started and not yet ended
+
+  explicit ZstdStreamDecompressor(ISink& downstream, size_t out_cap = kOutCap);
+  ~ZstdStreamDecompressor() override;
+  ZstdStreamDecompressor(const ZstdStreamDecompressor&) = delete;
+  ZstdStreamDecompressor& operator=(const ZstdStreamDecompressor&) = delete;
+
+  // frames must have been written with d, a mismatching id throws
+  void use_dictionary(const ZstdDictionary& d);
+
+  void write(const uint8_t* data, size_t n) override; // decompress block
+  void flush() override;
+  void finish() override; // throws on a truncated frame
+};
+
+// random-access input, used by seekable readers
+struct IRandomSource
+{
+  virtual ~IRandomSource() = default;
+  virtual uint64_t size() = 0;
+  virtual void read(uint64_t off, uint8_t* dst, size_t n) = 0; // throws on short read
+};
+
+struct MemorySource final : IRandomSource
+{
+  const uint8_t* data = nullptr;
+  size_t n = 0;
+
+  MemorySource(const void* p, size_t sz);
+  uint64_t size() override { return n; }
+  void read(uint64_t off, uint8_t* dst, size_t cnt) override;
+};
+
+struct IStreamSource final : IRandomSource
+{
+  std::istream& is;
+  explicit IStreamSource(std::istream& s);
+  uint64_t size() override;
+  void read(uint64_t off, uint8_t* dst, size_t cnt) override;
+};
+
 static constexpr uint64_t POW10[16] =
 {
   1ull,
@@ -111,109 +245,76 @@ static inline int64_t zigzag_decode(uint64_t z)
   return v ^ -static_cast<int64_t>(z & 1);
 }
 
-// ---- buffered bit writer (64 KiB), LSB-first ----
-struct BufferedBitWriter
-{
-  static constexpr size_t kBufCap = 64 * 1024;
-
-  ISink& sink;
-  std::array<uint8_t, kBufCap> buf{};
-  size_t pos = 0;
-  size_t total_sz = 0;
-  uint64_t acc = 0;
-  unsigned bits = 0;
-
-  explicit BufferedBitWriter(ISink& s);
-
-  uint64_t bits_written() const
-  {
-    return ((total_sz + pos) << 3) + bits;
-  }
-
-  void put(uint64_t v, unsigned b)
-  {
-    if( !b )
-      return;
-    const uint64_t mask = (b == 64) ? ~0ull : ((1ull << b) - 1);
-    acc |= (v & mask) << bits;
-    bits += b;
-    while( bits >= 8 )
-    {
-      write_byte(uint8_t(acc & 0xFF));
-      acc >>= 8;
-      bits -= 8;
-    }
-  }
-
-  void align_to_byte()
-  {
-    if( bits )
-    {
-      write_byte(uint8_t(acc & 0xFF));
-      acc = 0;
-      bits = 0;
-    }
-  }
+#ifdef __SIZEOF_INT128__
+using uint128_t = unsigned __int128;
+using int128_t = __int128;
 
-  void flush()
-  {
-    if( pos )
-    {
-      sink.write(buf.data(), pos);
-      total_sz+=pos;
-      pos = 0;
-    }
-    sink.flush();
-  }
+static inline uint128_t zigzag_encode128(int128_t v)
+{
+  return (uint128_t(v) << 1) ^ uint128_t(-int128_t(v < 0));
+}
+static inline int128_t zigzag_decode128(uint128_t z)
+{
+  int128_t v = static_cast<int128_t>(z >> 1);
+  return v ^ -static_cast<int128_t>(z & 1);
+}
+#endif
 
-  void finish()
+// ---- put_* API shared by the bit writers ----
+// Everything here is built on the writer's put(v, b), so the varint,
+// zero-flag, decimal and 128-bit encodings are defined once; a writer
+// may still shadow put_var with a faster equivalent (see SizeEstimator).
+template<typename W>
+struct BitWriterOps
+{
+  void put_var(uint64_t v)
   {
-    align_to_byte();
-    if( pos )
+    while( v >= 0x80 )
     {
-      sink.write(buf.data(), pos);
-      total_sz+=pos;
-      pos = 0;
+      self().put(uint8_t(v | 0x80), 8);
+      v >>= 7;
     }
-    sink.finish();
+    self().put(uint8_t(v), 8);
   }
-
-  void put_var(uint64_t v)
+  void put_var(uint32_t v) { self().put_var( (uint64_t)v ); }
+  void put_var(uint16_t v) { self().put_var( (uint64_t)v ); }
+  void put_var(uint8_t v) { self().put_var( (uint64_t)v ); }
+#ifdef __SIZEOF_INT128__
+  void put_var(uint128_t v)
   {
-    while( v >= 0x80 )
+    // 7-bit groups while the high word is set, then the 64-bit path
+    while( uint64_t(v >> 64) )
     {
-      put(uint8_t(v | 0x80), 8);
+      self().put(uint8_t(v | 0x80), 8);
       v >>= 7;
     }
-    put(uint8_t(v), 8);
+    self().put_var(uint64_t(v));
   }
-  void put_var(uint32_t v) { put_var( (uint64_t)v ); }
-  void put_var(uint16_t v) { put_var( (uint64_t)v ); }
-  void put_var(uint8_t v) { put_var( (uint64_t)v ); }
+#endif
   template<typename T>
   void put_var(T v) = delete;
 
   void put_var_zero(uint64_t v)
   {
-    put(v == 0, 1);
+    self().put(v == 0, 1);
     if( v == 0 )
       return;
 
-    put_var(v);
+    self().put_var(v);
   }
 
   void put_var_sign_zero(int64_t v)
   {
-    put(v == 0, 1);
+    self().put(v == 0, 1);
     if( v == 0 )
       return;
 
-    put_var(zigzag_encode(v));
+    self().put_var(zigzag_encode(v));
   }
 
   void put_var_dec_zeros(uint64_t v)
   {
-    put(v == 0, 1);
+    self().put(v == 0, 1);
     if( v == 0 )
       return;
 
@@ -230,13 +331,13 @@ struct BufferedBitWriter
         break;
     }
 
-    put(k, 4);
-    put_var(v);
+    self().put(k, 4);
+    self().put_var(v);
   }
 
   void put_var_sign_dec_zeros(int64_t sv)
   {
-    put(sv == 0, 1);
+    self().put(sv == 0, 1);
     if( sv == 0 )
       return;
 
@@ -253,50 +354,474 @@ struct BufferedBitWriter
         break;
     }
 
-    put(k, 4);
-    put_var(zigzag_encode(sv));
+    self().put(k, 4);
+    self().put_var(zigzag_encode(sv));
+  }
+
+#ifdef __SIZEOF_INT128__
+  void put128(uint128_t v, unsigned b)
+  {
+    if( b <= 64 )
+    {
+      self().put(uint64_t(v), b);
+      return;
+    }
+    self().put(uint64_t(v), 64);
+    self().put(uint64_t(v >> 64), b - 64);
+  }
+
+  void put_var128_zero(uint128_t v)
+  {
+    self().put(v == 0, 1);
+    if( v == 0 )
+      return;
+
+    self().put_var(v);
+  }
+
+  void put_var128_sign_zero(int128_t v)
+  {
+    self().put(v == 0, 1);
+    if( v == 0 )
+      return;
+
+    self().put_var(zigzag_encode128(v));
+  }
+#endif
+
+  // record-level presence bitmask: bit i set <=> field i follows
+  void put_presence(uint64_t mask, unsigned nfields)
+  {
+    assert( nfields <= 64 );
+    assert( nfields == 64 || (mask >> nfields) == 0 );
+    self().put(mask, nfields);
   }
 
   uint64_t put_var_zero(uint64_t v, uint64_t base)
   {
     assert( v>= base );
-    put_var_zero( v - base );
+    self().put_var_zero( v - base );
     return v;
   }
   uint64_t put_var(uint64_t v, uint64_t base)
   {
     assert( v>= base );
-    put_var( v - base );
+    self().put_var( v - base );
     return v;
   }
   uint64_t put_var_dec_zeros(uint64_t v, uint64_t base)
   {
     assert( v>= base );
-    put_var_dec_zeros( v - base );
+    self().put_var_dec_zeros( v - base );
     return v;
   }
   uint64_t put_var_sign_dec_zeros(uint64_t v, uint64_t base)
   {
-    put_var_sign_dec_zeros( v - base );
+    self().put_var_sign_dec_zeros( v - base );
     return v;
   }
   int64_t put_var_sign_zero(int64_t v, int64_t base)
   {
-    put_var_sign_zero( v - base );
+    self().put_var_sign_zero( v - base );
     return v;
   }
 
 private:
-  void write_byte(uint8_t b)
+  W& self() { return static_cast<W&>(*this); }
+};
+
+// ---- buffered bit writer (64 KiB by default), LSB-first ----
+struct BufferedBitWriter : BitWriterOps<BufferedBitWriter>
+{
+  static constexpr size_t kBufCap = 64 * 1024; // default capacity
+
+  ISink* sink;
+  std::unique_ptr<uint8_t[]> owned;
+  uint8_t* buf = nullptr;
+  size_t cap = 0;
+  size_t pos = 0;
+  size_t total_sz = 0;
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  bool pinned = false;
+
+  explicit BufferedBitWriter(ISink& s, size_t capacity = kBufCap);
+  // caller-owned (e.g. pooled) buffer, must outlive the writer
+  BufferedBitWriter(ISink& s, std::span<uint8_t> storage);
+
+  // starts over on a new sink, keeping the buffer; unwritten bits are dropped
+  void rebind(ISink& s)
   {
-    buf[pos++] = b;
-    if( pos == kBufCap )
+    sink = &s;
+    pos = 0;
+    total_sz = 0;
+    acc = 0;
+    bits = 0;
+    pinned = false;
+  }
+
+  uint64_t bits_written() const
+  {
+    return ((total_sz + pos) << 3) + bits;
+  }
+
+  // ---- transactions ----
+  struct Checkpoint
+  {
+    size_t pos;
+    size_t total_sz;
+    uint64_t acc;
+    unsigned bits;
+  };
+
+  Checkpoint checkpoint() const { return Checkpoint{ pos, total_sz, acc, bits }; }
+
+  // undoes everything written since cp, valid while nothing was spilled
+  void rollback(const Checkpoint& cp)
+  {
+    if( cp.total_sz != total_sz || cp.pos > pos )
+      throw std::logic_error("rollback across a buffer spill");
+    pos = cp.pos;
+    acc = cp.acc;
+    bits = cp.bits;
+  }
+
+  // spills now unless more than `reserve` bytes are free, then refuses to
+  // spill until unpin(): a transaction of up to `reserve` bytes can always
+  // be rolled back, a larger one throws std::length_error (roll back and
+  // unpin to recover)
+  void pin(size_t reserve)
+  {
+    if( reserve >= cap )
+      throw std::invalid_argument("pin reserve exceeds buffer");
+    if( cap - pos <= reserve )
+      spill();
+    pinned = true;
+  }
+
+  void unpin()
+  {
+    pinned = false;
+    if( pos == cap )
+      spill();
+  }
+
+  void put(uint64_t v, unsigned b)
+  {
+    if( !b )
+      return;
+    if( b > 56 )
+    {
+      // up to 7 bits may be pending in acc, split wide values
+      put(v, 32);
+      put(v >> 32, b - 32);
+      return;
+    }
+    const uint64_t mask = (b == 64) ? ~0ull : ((1ull << b) - 1);
+    acc |= (v & mask) << bits;
+    bits += b;
+    while( bits >= 8 )
     {
-      sink.write(buf.data(), pos);
+      write_byte(uint8_t(acc & 0xFF));
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+
+  void align_to_byte()
+  {
+    if( bits )
+    {
+      write_byte(uint8_t(acc & 0xFF));
+      acc = 0;
+      bits = 0;
+    }
+  }
+
+  void flush()
+  {
+    assert( !pinned );
+    if( pos )
+    {
+      sink->write(buf, pos);
       total_sz+=pos;
       pos = 0;
     }
+    sink->flush();
   }
+
+  // hands buffered whole bytes to the sink without flushing it
+  void drain()
+  {
+    assert( !pinned );
+    if( pos )
+      spill();
+  }
+
+  void finish()
+  {
+    align_to_byte();
+    if( pos )
+    {
+      sink->write(buf, pos);
+      total_sz+=pos;
+      pos = 0;
+    }
+    sink->finish();
+  }
+
+  // raw bytes, memcpy when byte aligned
+  void put_bytes(const uint8_t* data, size_t n)
+  {
+    if( bits )
+    {
+      for( size_t i = 0; i < n; ++i )
+        put(data[i], 8);
+      return;
+    }
+    while( n )
+    {
+      const size_t c = std::min(n, cap - pos);
+      std::memcpy(buf + pos, data, c);
+      pos += c;
+      data += c;
+      n -= c;
+      if( pos == cap )
+        spill();
+    }
+  }
+
+  // appends nbits of an LSB-first stream (e.g. another writer's output,
+  // nbits = its bits_written() before finish), bit-identical to having
+  // written its values here; whole words go through one funnel shift
+  void splice(const uint8_t* data, uint64_t nbits)
+  {
+    if( !bits )
+      put_bytes(data, size_t(nbits >> 3));
+    else
+    {
+      const unsigned sh = bits;
+      size_t i = 0;
+      for( ; i + 8 <= (nbits >> 3); i += 8 )
+      {
+        uint64_t w;
+        std::memcpy(&w, data + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        write_word(acc | (w << sh));
+        acc = w >> (64 - sh);
+      }
+      for( ; i < (nbits >> 3); ++i )
+        put(data[i], 8);
+    }
+    if( nbits & 7 )
+      put(data[nbits >> 3], unsigned(nbits & 7));
+  }
+
+private:
+  void write_byte(uint8_t b)
+  {
+    buf[pos++] = b;
+    if( pos == cap )
+      spill();
+  }
+
+  void write_word(uint64_t w)
+  {
+    if( cap - pos < 8 )
+    {
+      for( unsigned i = 0; i < 8; ++i, w >>= 8 )
+        write_byte(uint8_t(w));
+      return;
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    std::memcpy(buf + pos, &w, 8);
+    pos += 8;
+    if( pos == cap )
+      spill();
+  }
+
+  void spill()
+  {
+    if( pinned )
+      throw std::length_error("pinned writer buffer full");
+    sink->write(buf, pos);
+    total_sz+=pos;
+    pos = 0;
+  }
+};
+
+// ---- dry-run sizing: the BufferedBitWriter put_* API, summing bits only ----
+// bits_written() equals that of a writer fed the same calls
+struct SizeEstimator : BitWriterOps<SizeEstimator>
+{
+  uint64_t nbits = 0;
+
+  uint64_t bits_written() const { return nbits; }
+  uint64_t bytes() const { return (nbits + 7) >> 3; } // after finish()
+  void reset() { nbits = 0; }
+
+  // varint bytes of v, ceil(bit length / 7) and at least one
+  static unsigned var_bytes(uint64_t v)
+  {
+    return 1 + unsigned(63 - __builtin_clzll(v | 1)) / 7;
+  }
+
+  void put(uint64_t, unsigned b) { nbits += b; }
+  void align_to_byte() { nbits = (nbits + 7) & ~uint64_t(7); }
+  void flush() {}
+  void finish() { align_to_byte(); }
+
+  // varint sizes in O(1), the rest of the API sizes through these
+  using BitWriterOps<SizeEstimator>::put_var;
+  void put_var(uint64_t v) { nbits += 8 * var_bytes(v); }
+#ifdef __SIZEOF_INT128__
+  void put_var(uint128_t v)
+  {
+    const uint64_t hi = uint64_t(v >> 64);
+    if( !hi )
+      return put_var(uint64_t(v));
+    nbits += 8 * ((128 - unsigned(__builtin_clzll(hi)) + 6) / 7);
+  }
+#endif
+
+  void put_bytes(const uint8_t*, size_t n) { nbits += uint64_t(n) << 3; }
+  void splice(const uint8_t*, uint64_t n) { nbits += n; }
+};
+
+// ---- bit writer straight into a caller-owned span, no sink, LSB-first ----
+// Checked throws std::length_error on overflow; unchecked leaves capacity
+// to the caller (e.g. sized by SizeEstimator) and only asserts
+template<bool Checked = true>
+struct SpanBitWriter : BitWriterOps<SpanBitWriter<Checked>>
+{
+  uint8_t* data;
+  size_t cap;
+  size_t pos = 0;
+  uint64_t acc = 0;
+  unsigned bits = 0;
+
+  explicit SpanBitWriter(std::span<uint8_t> s) : data{ s.data() }, cap{ s.size() } {}
+
+  uint64_t bits_written() const { return (uint64_t(pos) << 3) + bits; }
+
+  // written bytes, valid after finish()
+  std::span<uint8_t> written() const { return { data, pos }; }
+
+  void put(uint64_t v, unsigned b)
+  {
+    if( !b )
+      return;
+    if( b > 56 )
+    {
+      put(v, 32);
+      put(v >> 32, b - 32);
+      return;
+    }
+    acc |= (v & (~0ull >> (64 - b))) << bits;
+    bits += b;
+    if( bits >= 8 )
+      emit();
+  }
+
+  void align_to_byte()
+  {
+    if( bits )
+    {
+      bits = 8;
+      emit();
+    }
+  }
+
+  void flush() {}
+
+  size_t finish()
+  {
+    align_to_byte();
+    return pos;
+  }
+
+  void put_bytes(const uint8_t* src, size_t n)
+  {
+    if( bits )
+    {
+      for( size_t i = 0; i < n; ++i )
+        put(src[i], 8);
+      return;
+    }
+    reserve(n);
+    std::memcpy(data + pos, src, n);
+    pos += n;
+  }
+
+  // see BufferedBitWriter::splice
+  void splice(const uint8_t* src, uint64_t nbits)
+  {
+    if( !bits )
+      put_bytes(src, size_t(nbits >> 3));
+    else
+    {
+      for( size_t i = 0; i < (nbits >> 3); ++i )
+        put(src[i], 8);
+    }
+    if( nbits & 7 )
+      put(src[nbits >> 3], unsigned(nbits & 7));
+  }
+
+private:
+  void reserve(size_t n)
+  {
+    if constexpr( Checked )
+    {
+      if( cap - pos < n )
+        throw std::length_error("span bit writer overflow");
+    }
+    else
+      assert( cap - pos >= n );
+  }
+
+  // stores the whole bytes of acc, one 8-byte store when the span allows
+  void emit()
+  {
+    const unsigned n = bits >> 3;
+    reserve(n);
+    if( cap - pos >= 8 )
+    {
+      uint64_t w = acc;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      w = __builtin_bswap64(w);
+#endif
+      std::memcpy(data + pos, &w, 8);
+    }
+    else
+    {
+      for( unsigned i = 0; i < n; ++i )
+        data[pos + i] = uint8_t(acc >> (8 * i));
+    }
+    pos += n;
+    acc >>= 8 * n;
+    bits &= 7;
+  }
+};
+
+// field encodings, used by schema-driven skipping and decoding
+enum class FieldKind : uint8_t
+{
+  Bits,         // put(v, width)
+  Var,          // put_var
+  VarZero,      // put_var_zero
+  VarSignZero,  // put_var_sign_zero
+  DecZeros,     // put_var_dec_zeros
+  SignDecZeros, // put_var_sign_dec_zeros
+};
+
+struct FieldSpec
+{
+  FieldKind kind;
+  uint8_t width = 0; // Bits only
 };
 
 struct BitReader
@@ -308,71 +833,491 @@ struct BitReader
 
   BitReader(const uint8_t* p_, const uint8_t* end_);
 
+  // tops acc up to at least 56 bits while input remains, bits above
+  // `bits` stay zero
+  void refill()
+  {
+    if( bits >= 56 )
+      return;
+    if( end - p >= 8 )
+    {
+      uint64_t w;
+      std::memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      w = __builtin_bswap64(w);
+#endif
+      const unsigned n = (63 - bits) >> 3;
+      acc |= (w & (~0ull >> (64 - 8 * n))) << bits;
+      p += n;
+      bits += 8 * n;
+      return;
+    }
+    while( bits <= 56 && p != end )
+    {
+      acc |= uint64_t(*p++) << bits;
+      bits += 8;
+    }
+  }
+
   uint64_t get(unsigned b)
   {
     if( !b )
       return 0;
-    while( bits < b )
+    if( b > 56 )
+    {
+      // refill guarantees 56 bits, split wide reads
+      uint64_t lo = get(32);
+      return lo | (get(b - 32) << 32);
+    }
+    if( bits < b )
     {
-      if( p == end )
+      refill();
+      if( bits < b )
         throw std::runtime_error("bitstream underflow");
-      acc |= uint64_t(*p++) << bits;
-      bits += 8;
     }
-    const uint64_t mask = (b == 64) ? ~0ull : ((1ull << b) - 1);
+    const uint64_t mask = (1ull << b) - 1;
     uint64_t v = acc & mask;
     acc >>= b;
     bits -= b;
     return v;
   }
 
+  // next b bits (b <= 56) without consuming, zero past end of input
+  uint64_t peek(unsigned b)
+  {
+    assert( b <= 56 );
+    if( bits < b )
+      refill();
+    return acc & ((1ull << b) - 1);
+  }
+
+  void consume(unsigned b)
+  {
+    assert( b <= 56 );
+    if( bits < b )
+      throw std::runtime_error("bitstream underflow");
+    acc >>= b;
+    bits -= b;
+  }
+
+  // compacts the 7-bit groups of a varint held in the low 7 bytes of m,
+  // m must be masked to the varint length
+  static uint64_t var_word_value(uint64_t m)
+  {
+    return (m & 0x7F)
+         | ((m >> 1) & (0x7Full << 7))
+         | ((m >> 2) & (0x7Full << 14))
+         | ((m >> 3) & (0x7Full << 21))
+         | ((m >> 4) & (0x7Full << 28))
+         | ((m >> 5) & (0x7Full << 35))
+         | ((m >> 6) & (0x7Full << 42));
+  }
+
   uint64_t get_var64()
   {
-    uint64_t v = 0;
-    unsigned shift = 0;
-    for( ;; )
+    // single byte straight from acc, else up to 7 bytes from one peek
+    if( bits >= 8 && !(acc & 0x80) )
+    {
+      const uint64_t v = acc & 0x7F;
+      acc >>= 8;
+      bits -= 8;
+      return v;
+    }
+    const uint64_t x = peek(56);
+    const uint64_t stop = ~x & 0x80808080808080ull;
+    if( stop )
+    {
+      const unsigned n = unsigned(__builtin_ctzll(stop)) + 1;
+      consume(n);
+      return var_word_value(x & (~0ull >> (64 - n)));
+    }
+    return get_var64_slow();
+  }
+  // at most 5 bytes, 5th byte may carry only the top 4 bits
+  uint32_t get_var32()
+  {
+    if( bits < 40 )
+      refill();
+    if( bits < 40 )
+      return get_var32_slow();
+
+    const uint64_t x = acc;
+    const uint64_t stop = ~x & 0x8080808080ull;
+    if( !stop )
+      throw std::runtime_error("bad varint");
+    const unsigned n = unsigned(__builtin_ctzll(stop)) + 1;
+    const uint64_t m = x & (~0ull >> (64 - n));
+    if( m >> 36 )
+      throw std::runtime_error("bad varint");
+    acc >>= n;
+    bits -= n;
+    return uint32_t( (m & 0x7F)
+                   | ((m >> 1) & 0x3F80)
+                   | ((m >> 2) & 0x1FC000)
+                   | ((m >> 3) & 0xFE00000)
+                   | ((m >> 4) & 0xF0000000) );
+  }
+  uint32_t get_var32_zero()
+  {
+    if( get(1) )
+      return 0;
+
+    return get_var32();
+  }
+  int32_t get_var32_sign_zero()
+  {
+    if( get(1) )
+      return 0;
+
+    return int32_t(zigzag_decode(get_var32()));
+  }
+  // 32-bit mantissa, scaled result may need 64 bits
+  uint64_t get_var32_dec_zeros()
+  {
+    if( get(1) )
+      return 0;
+
+    unsigned k = (unsigned)get(4);
+    return uint64_t(get_var32()) * POW10[k];
+  }
+  int64_t get_var32_sign_dec_zeros()
+  {
+    if( get(1) )
+      return 0;
+
+    unsigned k = (unsigned)get(4);
+    return zigzag_decode(get_var32()) * int64_t(POW10[k]);
+  }
+
+#ifdef __SIZEOF_INT128__
+  uint128_t get128(unsigned b)
+  {
+    if( b <= 64 )
+      return get(b);
+    uint128_t lo = get(64);
+    return lo | (uint128_t(get(b - 64)) << 64);
+  }
+
+  uint128_t get_var128()
+  {
+    // first 9 groups fit a 64-bit accumulator
+    uint64_t lo = 0;
+    for( unsigned shift = 0; shift < 63; shift += 7 )
     {
       uint8_t b = get(8);
-      v |= uint64_t(b & 0x7F) << shift;
+      lo |= uint64_t(b & 0x7F) << shift;
+      if( (b & 0x80) == 0 )
+        return lo;
+    }
+    uint128_t v = lo;
+    for( unsigned shift = 63; shift < 128; shift += 7 )
+    {
+      uint8_t b = get(8);
+      v |= uint128_t(b & 0x7F) << shift;
       if( (b & 0x80) == 0 )
         return v;
-      shift += 7;
-      if( shift >= 64 )
-        throw std::runtime_error("bad varint");
     }
+    throw std::runtime_error("bad varint");
   }
-  uint64_t get_var64_zero()
+  uint128_t get_var128_zero()
   {
     if( get(1) )
       return 0;
 
-    return get_var64();
+    return get_var128();
   }
-  uint64_t get_var64_dec_zeros()
+  int128_t get_var128_sign_zero()
   {
     if( get(1) )
       return 0;
 
-    unsigned k = (unsigned)get(4);
-    uint64_t v = get_var64();
+    return zigzag_decode128(get_var128());
+  }
+#endif
+
+  void get_bytes(uint8_t* dst, size_t n)
+  {
+    if( bits & 7 )
+    {
+      for( size_t i = 0; i < n; ++i )
+        dst[i] = uint8_t(get(8));
+      return;
+    }
+    for( ; n && bits; --n )
+      *dst++ = uint8_t(get(8));
+    if( !n ) // dst may be null
+      return;
+    if( size_t(end - p) < n )
+      throw std::runtime_error("bitstream underflow");
+    std::memcpy(dst, p, n);
+    p += n;
+  }
+
+  uint64_t get_presence(unsigned nfields)
+  {
+    assert( nfields <= 64 );
+    return get(nfields);
+  }
+
+  uint64_t get_var64_zero()
+  {
+    unsigned h;
+    uint64_t v;
+    if( !get_flagged(1, h, v) )
+      return 0;
+
+    return v;
+  }
+  uint64_t get_var64_dec_zeros()
+  {
+    unsigned k;
+    uint64_t v;
+    if( !get_flagged(5, k, v) )
+      return 0;
+
     return v * POW10[k];
   }
   int64_t get_var64_sign_dec_zeros()
   {
-    if( get(1) )
+    unsigned k;
+    uint64_t v;
+    if( !get_flagged(5, k, v) )
       return 0;
 
-    unsigned k = (unsigned)get(4);
-    return zigzag_decode( get_var64() ) * POW10[k];
+    return zigzag_decode(v) * POW10[k];
   }
   uint64_t get_var64_sign_zero()
   {
-    if( get(1) )
+    unsigned h;
+    uint64_t v;
+    if( !get_flagged(1, h, v) )
       return 0;
 
-    return zigzag_decode(get_var64());
+    return zigzag_decode(v);
+  }
+
+  // ---- skipping, advances without building values ----
+  void skip_bits(uint64_t n)
+  {
+    if( n < bits )
+    {
+      acc >>= n;
+      bits -= unsigned(n);
+      return;
+    }
+    // n == bits may be 64 after a tail refill, never shift by it
+    n -= bits;
+    acc = 0;
+    bits = 0;
+    if( (n >> 3) > uint64_t(end - p) )
+      throw std::runtime_error("bitstream underflow");
+    p += n >> 3;
+    get(unsigned(n & 7));
+  }
+
+  void skip_var64()
+  {
+    // continuation bits of 7 bytes at once, then the last 3
+    uint64_t stop = ~peek(56) & 0x80808080808080ull;
+    if( !stop )
+    {
+      consume(56);
+      stop = ~peek(24) & 0x808080ull;
+      if( !stop )
+        throw std::runtime_error("bad varint");
+    }
+    consume(unsigned(__builtin_ctzll(stop)) + 1);
+  }
+  void skip_var64_zero() { skip_flagged(1); }
+  void skip_dec_zeros() { skip_flagged(5); }
+
+  void skip_field(const FieldSpec& f)
+  {
+    switch( f.kind )
+    {
+      case FieldKind::Bits: skip_bits(f.width); break;
+      case FieldKind::Var: skip_var64(); break;
+      case FieldKind::VarZero:
+      case FieldKind::VarSignZero: skip_var64_zero(); break;
+      case FieldKind::DecZeros:
+      case FieldKind::SignDecZeros: skip_dec_zeros(); break;
+    }
+  }
+
+  // one field as int64_t, unsigned encodings are reinterpreted
+  int64_t get_field(const FieldSpec& f)
+  {
+    switch( f.kind )
+    {
+      case FieldKind::Bits: return int64_t(get(f.width));
+      case FieldKind::Var: return int64_t(get_var64());
+      case FieldKind::VarZero: return int64_t(get_var64_zero());
+      case FieldKind::VarSignZero: return int64_t(get_var64_sign_zero());
+      case FieldKind::DecZeros: return int64_t(get_var64_dec_zeros());
+      case FieldKind::SignDecZeros: return get_var64_sign_dec_zeros();
+    }
+    return 0;
+  }
+
+  void skip_record(const FieldSpec* fields, size_t n)
+  {
+    for( size_t i = 0; i < n; ++i )
+      skip_field(fields[i]);
+  }
+
+  // presence-masked record, see encode_present
+  void skip_present(const FieldSpec* fields, unsigned nfields)
+  {
+    for( uint64_t m = get_presence(nfields); m; m &= m - 1 )
+      skip_field(fields[__builtin_ctzll(m)]);
+  }
+
+private:
+  void skip_flagged(unsigned hdr)
+  {
+    const uint64_t x = peek(56);
+    if( x & 1 )
+    {
+      consume(1);
+      return;
+    }
+    const uint64_t stop = ~(x >> hdr) & 0x808080808080ull;
+    if( stop )
+    {
+      consume(hdr + unsigned(__builtin_ctzll(stop)) + 1);
+      return;
+    }
+    consume(hdr);
+    skip_var64();
+  }
+
+  // zero flag, hdr-1 header bits and a varint of up to 6 bytes decoded
+  // from a single peek; false on the zero flag, header bits go to h
+  bool get_flagged(unsigned hdr, unsigned& h, uint64_t& v)
+  {
+    const uint64_t x = peek(56);
+    if( x & 1 )
+    {
+      consume(1);
+      return false;
+    }
+    h = unsigned(x >> 1) & ((1u << (hdr - 1)) - 1);
+    const uint64_t y = x >> hdr;
+    const uint64_t stop = ~y & 0x808080808080ull;
+    if( stop )
+    {
+      const unsigned n = unsigned(__builtin_ctzll(stop)) + 1;
+      consume(hdr + n);
+      v = var_word_value(y & (~0ull >> (64 - n)));
+      return true;
+    }
+    consume(hdr);
+    v = get_var64_slow();
+    return true;
+  }
+
+  uint64_t get_var64_slow()
+  {
+    uint64_t v = 0;
+    unsigned shift = 0;
+    for( ;; )
+    {
+      uint8_t b = get(8);
+      v |= uint64_t(b & 0x7F) << shift;
+      if( (b & 0x80) == 0 )
+        return v;
+      shift += 7;
+      if( shift >= 64 )
+        throw std::runtime_error("bad varint");
+    }
+  }
+
+  uint32_t get_var32_slow()
+  {
+    uint32_t v = 0;
+    for( unsigned shift = 0; shift < 28; shift += 7 )
+    {
+      uint8_t b = get(8);
+      v |= uint32_t(b & 0x7F) << shift;
+      if( (b & 0x80) == 0 )
+        return v;
+    }
+    uint8_t b = get(8);
+    if( b > 0x0F )
+      throw std::runtime_error("bad varint");
+    return v | (uint32_t(b) << 28);
   }
 };
 
+// ---- interleaved multi-stream decode ----
+// Advances K independent readers round-robin within one loop so their
+// dependency chains overlap. Readers are copied to locals for the hot
+// loop, otherwise every uint64_t store to an output may alias acc.
+template<typename T, typename Fn, size_t... I>
+inline void decode_interleaved_k(BitReader* readers, const std::span<T>* outs, Fn& fn, std::index_sequence<I...>)
+{
+  constexpr size_t K = sizeof...(I);
+  BitReader r[K] = { readers[I]... };
+  const size_t n = std::min({ outs[I].size()... });
+  for( size_t i = 0; i < n; ++i )
+    for( size_t s = 0; s < K; ++s )
+      outs[s][i] = fn(r[s]);
+  for( size_t s = 0; s < K; ++s )
+  {
+    for( size_t i = n; i < outs[s].size(); ++i )
+      outs[s][i] = fn(r[s]);
+    readers[s] = r[s];
+  }
+}
+
+// fills outs[s] from readers[s] for s < k, fn decodes one value
+template<typename T, typename Fn>
+inline void decode_interleaved(BitReader* readers, const std::span<T>* outs, size_t k, Fn fn)
+{
+  size_t s = 0;
+  for( ; s + 4 <= k; s += 4 )
+    decode_interleaved_k(readers + s, outs + s, fn, std::make_index_sequence<4>{});
+  switch( k - s )
+  {
+    case 3: decode_interleaved_k(readers + s, outs + s, fn, std::make_index_sequence<3>{}); break;
+    case 2: decode_interleaved_k(readers + s, outs + s, fn, std::make_index_sequence<2>{}); break;
+    case 1: decode_interleaved_k(readers + s, outs + s, fn, std::make_index_sequence<1>{}); break;
+    default: break;
+  }
+}
+
+inline void decode_var64_interleaved(BitReader* readers, const std::span<uint64_t>* outs, size_t k)
+{
+  decode_interleaved(readers, outs, k, [](BitReader& r) { return r.get_var64(); });
 }
 
+// ---- presence bitmask field dispatch ----
+template<typename Rec>
+using FieldEncoder = void (*)(BufferedBitWriter&, const Rec&);
+
+template<typename Rec>
+using FieldDecoder = void (*)(BitReader&, Rec&);
+
+// writes mask, then table[i] for every set bit i, lowest first
+template<typename Rec>
+inline void encode_present(BufferedBitWriter& w, uint64_t mask, unsigned nfields, const FieldEncoder<Rec>* table, const Rec& rec)
+{
+  w.put_presence(mask, nfields);
+  while( mask )
+  {
+    table[__builtin_ctzll(mask)](w, rec);
+    mask &= mask - 1;
+  }
+}
+
+// reads mask, then dispatches table[i] for every set bit i, returns mask
+template<typename Rec>
+inline uint64_t decode_present(BitReader& r, unsigned nfields, const FieldDecoder<Rec>* table, Rec& rec)
+{
+  const uint64_t mask = r.get_presence(nfields);
+  for( uint64_t m = mask; m; m &= m - 1 )
+    table[__builtin_ctzll(m)](r, rec);
+  return mask;
+}
+
+}
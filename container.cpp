@@ -0,0 +1,398 @@
+/*
+* container.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "container.h"
+#include <zstd.h>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+FrameIndexEntry make_index_entry(const QuoteColumns& c, size_t n, unsigned bloom_bits_per_key,
+                                 std::vector<uint32_t>& keys, std::vector<BloomLine>& bloom)
+{
+  FrameIndexEntry e;
+  e.records = uint32_t(n);
+  if( !n )
+    return e;
+
+  const auto [lo_ts, hi_ts] = std::minmax_element(c.ts.begin(), c.ts.begin() + n);
+  e.min_ts = *lo_ts;
+  e.max_ts = *hi_ts;
+  const auto [lo_i, hi_i] = std::minmax_element(c.instr.begin(), c.instr.begin() + n);
+  e.min_instr = *lo_i;
+  e.max_instr = *hi_i;
+  const auto [lo_px, hi_px] = std::minmax_element(c.px.begin(), c.px.begin() + n);
+  e.min_px = *lo_px;
+  e.max_px = *hi_px;
+
+  if( bloom_bits_per_key )
+  {
+    keys.assign(c.instr.begin(), c.instr.begin() + n);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    const size_t nbits = keys.size() * bloom_bits_per_key;
+    e.bloom_off = uint32_t(bloom.size());
+    e.bloom_lines = uint32_t((nbits + 511) / 512);
+    bloom.resize(bloom.size() + e.bloom_lines, BloomLine{});
+    for( uint32_t k : keys )
+      BlockedBloom::insert(bloom.data() + e.bloom_off, e.bloom_lines, k);
+  }
+  return e;
+}
+
+void encode_frame(ZSTD_CCtx* cctx, const QuoteColumns& c, size_t n, BlockLayout layout,
+                  std::vector<uint8_t>& raw, std::vector<uint8_t>& comp)
+{
+  raw.clear();
+  {
+    VectorSink vs(raw);
+    BufferedBitWriter w(vs);
+    put_block(w, c.ts.data(), c.instr.data(), c.px.data(), c.sz.data(), n, layout);
+    w.finish();
+  }
+
+  comp.resize(ZSTD_compressBound(raw.size()));
+  size_t rc = ZSTD_compress2(cctx, comp.data(), comp.size(), raw.data(), raw.size());
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+  comp.resize(rc);
+}
+
+void decode_frame(ZSTD_DCtx* dctx, const uint8_t* comp, size_t csize, size_t max_raw, std::vector<uint8_t>& raw)
+{
+  const unsigned long long rsz = ZSTD_getFrameContentSize(comp, csize);
+  if( rsz == ZSTD_CONTENTSIZE_ERROR || rsz == ZSTD_CONTENTSIZE_UNKNOWN || rsz > max_raw )
+    throw std::runtime_error("bad container frame");
+  raw.resize(rsz);
+  size_t rc = ZSTD_decompressDCtx(dctx, raw.data(), raw.size(), comp, csize);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+}
+
+SeekableWriter::SeekableWriter(ISink& sink, size_t records_per_frame, int lvl, unsigned bloom_bits, BlockLayout lay)
+:
+  out{ sink },
+  frame_records{ records_per_frame },
+  level{ lvl },
+  bloom_bits_per_key{ bloom_bits },
+  layout{ lay }
+{
+  if( !frame_records || frame_records > std::numeric_limits<uint32_t>::max() )
+    throw std::invalid_argument("bad records per frame");
+  cols.columns(frame_records);
+  cctx = create_cctx(level);
+}
+
+SeekableWriter::~SeekableWriter()
+{
+  if( cctx )
+    ZSTD_freeCCtx(cctx);
+}
+
+void SeekableWriter::flush_frame()
+{
+  if( !pending )
+    return;
+
+  const size_t n = pending;
+  pending = 0;
+
+  const QuoteColumns c{ { cols.ts.data(), n }, { cols.instr.data(), n }, { cols.px.data(), n }, { cols.sz.data(), n } };
+  FrameIndexEntry e = make_index_entry(c, n, bloom_bits_per_key, keys, bloom);
+  encode_frame(cctx, c, n, layout, raw, comp);
+  write_frame(comp.data(), comp.size(), e);
+}
+
+void SeekableWriter::append_frame(const uint8_t* data, size_t csize, FrameIndexEntry e, const BloomLine* lines)
+{
+  if( pending )
+    throw std::logic_error("append_frame with records pending");
+
+  e.bloom_off = uint32_t(bloom.size());
+  if( lines )
+    bloom.insert(bloom.end(), lines, lines + e.bloom_lines);
+  else
+    e.bloom_lines = 0;
+  write_frame(data, csize, e);
+}
+
+void SeekableWriter::write_frame(const uint8_t* data, size_t csize, FrameIndexEntry& e)
+{
+  if( csize > std::numeric_limits<uint32_t>::max() )
+    throw std::runtime_error("container frame too large");
+  e.offset = offset;
+  e.csize = uint32_t(csize);
+  out.write(data, csize);
+  offset += csize;
+  index.push_back(e);
+}
+
+void SeekableWriter::finish()
+{
+  flush_frame();
+
+  BufferedBitWriter w(out);
+  for( const FrameIndexEntry& e : index )
+  {
+    w.put_var(uint64_t(e.csize));
+    w.put_var(uint64_t(e.records));
+    w.put_var(e.min_ts);
+    w.put_var(e.max_ts - e.min_ts);
+    w.put_var(e.min_instr);
+    w.put_var(uint32_t(e.max_instr - e.min_instr));
+    w.put_var(zigzag_encode(e.min_px));
+    w.put_var(uint64_t(e.max_px) - uint64_t(e.min_px));
+    w.put_var(e.bloom_lines);
+    for( uint32_t l = 0; l < e.bloom_lines; ++l )
+      for( uint64_t word : bloom[e.bloom_off + l].w )
+        w.put(word, 64);
+  }
+  w.align_to_byte();
+  w.put(offset, 64);
+  w.put(index.size(), 32);
+  w.put(kContainerMagic, 32);
+  w.finish();
+}
+
+SeekableReader::SeekableReader(IRandomSource& source)
+:
+  src{ source }
+{
+  const uint64_t sz = src.size();
+  if( sz < kContainerFooterSz )
+    throw std::runtime_error("container too small");
+
+  uint8_t footer[kContainerFooterSz];
+  src.read(sz - kContainerFooterSz, footer, kContainerFooterSz);
+  BitReader fr(footer, footer + kContainerFooterSz);
+  const uint64_t index_off = fr.get(64);
+  const uint64_t nframes = fr.get(32);
+  if( fr.get(32) != kContainerMagic )
+    throw std::runtime_error("bad container magic");
+  if( index_off > sz - kContainerFooterSz )
+    throw std::runtime_error("bad container index offset");
+
+  std::vector<uint8_t> ib(sz - kContainerFooterSz - index_off);
+  if( !ib.empty() ) // an empty container has no index bytes
+    src.read(index_off, ib.data(), ib.size());
+  BitReader r(ib.data(), ib.data() + ib.size());
+  // an entry is at least 9 varint bytes, don't trust a corrupt count
+  if( nframes > ib.size() / 9 )
+    throw std::runtime_error("bad container frame count");
+  index.resize(nframes);
+  uint64_t off = 0;
+  for( FrameIndexEntry& e : index )
+  {
+    e.offset = off;
+    e.csize = uint32_t(r.get_var64());
+    e.records = uint32_t(r.get_var64());
+    e.min_ts = r.get_var64();
+    e.max_ts = e.min_ts + r.get_var64();
+    e.min_instr = r.get_var32();
+    e.max_instr = e.min_instr + r.get_var32();
+    e.min_px = zigzag_decode(r.get_var64());
+    e.max_px = int64_t(uint64_t(e.min_px) + r.get_var64());
+    e.bloom_lines = r.get_var32();
+    e.bloom_off = uint32_t(bloom.size());
+    if( e.bloom_lines > ib.size() / 64 )
+      throw std::runtime_error("bad container bloom size");
+    bloom.resize(bloom.size() + e.bloom_lines);
+    for( uint32_t l = 0; l < e.bloom_lines; ++l )
+      for( uint64_t& word : bloom[e.bloom_off + l].w )
+        word = r.get(64);
+    off += e.csize;
+  }
+  if( off != index_off )
+    throw std::runtime_error("container index does not match frames");
+
+  dctx = ZSTD_createDCtx();
+  if( !dctx )
+    throw std::runtime_error("ZSTD_createDCtx failed");
+}
+
+SeekableReader::~SeekableReader()
+{
+  if( dctx )
+    ZSTD_freeDCtx(dctx);
+}
+
+const std::vector<uint8_t>& SeekableReader::load_frame(size_t i)
+{
+  const FrameIndexEntry& e = index.at(i);
+  comp.resize(e.csize);
+  src.read(e.offset, comp.data(), comp.size());
+  decode_frame(dctx, comp.data(), comp.size(), max_block_bytes(e.records), raw);
+  ++frames_read;
+  return raw;
+}
+
+size_t SeekableReader::read_frame(size_t i, QuoteColumnBuffer& buf)
+{
+  const std::vector<uint8_t>& b = load_frame(i);
+  BitReader r(b.data(), b.data() + b.size());
+  const size_t n = get_block(r, buf);
+  if( n != index[i].records )
+    throw std::runtime_error("container frame record count mismatch");
+  return n;
+}
+
+std::vector<size_t> SeekableReader::candidate_frames(const QuoteQuery& q) const
+{
+  std::vector<size_t> out;
+  for( size_t i = 0; i < index.size(); ++i )
+    if( frame_may_match(i, q) )
+      out.push_back(i);
+  return out;
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+static uint64_t ct_ts(size_t i) { return uint64_t(i) * 10; }
+static uint32_t ct_instr(size_t i) { return uint32_t(i / 64 * 8 + i % 8); }
+static int64_t ct_px(size_t i) { return int64_t(i % 64) - int64_t(i / 64) * 100; }
+static uint64_t ct_sz(size_t i) { return i % 5 * 1000; }
+
+// writer -> reader round trip in both layouts, zone maps prune frames
+// before they are read, and a corrupt footer is rejected
+static int reg1 = add_test( []()
+{
+  static constexpr size_t kFrame = 64;
+  static constexpr size_t kRecords = 20 * kFrame + 17;
+  for( const BlockLayout layout : { BlockLayout::Columnar, BlockLayout::Row } )
+  {
+    std::vector<uint8_t> file;
+    {
+      VectorSink vs(file);
+      SeekableWriter w(vs, kFrame, 3, 0, layout);
+      for( size_t i = 0; i < kRecords; ++i )
+        w.add(ct_ts(i), ct_instr(i), ct_px(i), ct_sz(i));
+      w.finish();
+    }
+
+    MemorySource src(file.data(), file.size());
+    SeekableReader r(src);
+    expect(r.frames() == 21, "container frames");
+    QuoteColumnBuffer buf;
+    size_t i = 0;
+    for( size_t f = 0; f < r.frames(); ++f )
+    {
+      const size_t n = r.read_frame(f, buf);
+      expect(n == (f < 20 ? kFrame : 17), "container frame records");
+      for( size_t j = 0; j < n; ++j, ++i )
+        expect(buf.ts[j] == ct_ts(i) && buf.instr[j] == ct_instr(i)
+            && buf.px[j] == ct_px(i) && buf.sz[j] == ct_sz(i), "container record");
+    }
+    expect(i == kRecords, "container record count");
+
+    // ts 6400..7000 is records 640..700, all in frame 10
+    QuoteQuery q;
+    q.ts_from = 6400;
+    q.ts_to = 7000;
+    expect(r.candidate_frames(q) == std::vector<size_t>{ 10 }, "container ts pruning");
+    q.ts_to = 7100;
+    expect(r.candidate_frames(q) == std::vector<size_t>{ 10, 11 }, "container ts pruning span");
+
+    // px reaches -1000 from frame 10 on, instr 90..95 is frame 11 only
+    QuoteQuery p;
+    p.px_to = -1000;
+    p.instr_from = 90;
+    p.instr_to = 95;
+    const std::vector<size_t> cand = r.candidate_frames(p);
+    expect(cand == std::vector<size_t>{ 11 }, "container px/instr pruning");
+
+    size_t want = 0;
+    for( size_t k = 0; k < kRecords; ++k )
+      want += p.matches(ct_ts(k), ct_instr(k), ct_px(k));
+    const uint64_t read0 = r.frames_read;
+    size_t seen = 0;
+    const size_t hits = r.scan(p, buf, [&](uint64_t ts, uint32_t instr, int64_t px, uint64_t)
+    {
+      expect(p.matches(ts, instr, px), "container scan match");
+      ++seen;
+    });
+    expect(want && hits == want && seen == want, "container scan hits");
+    expect(r.frames_read - read0 == cand.size(), "container scan frames read");
+  }
+
+  std::vector<uint8_t> file;
+  {
+    VectorSink vs(file);
+    SeekableWriter w(vs, kFrame);
+    for( size_t i = 0; i < kRecords; ++i )
+      w.add(ct_ts(i), ct_instr(i), ct_px(i), ct_sz(i));
+    w.finish();
+  }
+  std::memset(file.data() + file.size() - 8, 0xFF, 4);
+  MemorySource src(file.data(), file.size());
+  std::string err;
+  try
+  {
+    SeekableReader r(src);
+  }
+  catch( const std::exception& e )
+  {
+    err = e.what();
+  }
+  expect(err == "bad container frame count", "container corrupt frame count");
+} );
+
+// every frame's filter finds all of its instruments, and a single
+// instrument query skips frames whose zone maps can't rule them out
+static int reg2 = add_test( []()
+{
+  static constexpr size_t kFrames = 100;
+  static constexpr size_t kFrame = 64;
+  // frame f holds instruments f*1000 + 0..63, plus 0 and 999999 so every
+  // instrument zone map spans the whole key range
+  const auto instr = [](size_t f, size_t j) -> uint32_t
+  {
+    return j == 0 ? 0 : j == 1 ? 999999 : uint32_t(f * 1000 + j);
+  };
+  std::vector<uint8_t> file;
+  {
+    VectorSink vs(file);
+    SeekableWriter w(vs, kFrame, 3, 10);
+    for( size_t f = 0; f < kFrames; ++f )
+      for( size_t j = 0; j < kFrame; ++j )
+        w.add(f * kFrame + j, instr(f, j), 100, 1);
+    w.finish();
+  }
+
+  MemorySource src(file.data(), file.size());
+  SeekableReader r(src);
+  size_t false_pos = 0;
+  for( size_t f = 0; f < kFrames; ++f )
+  {
+    expect(r.index[f].bloom_lines > 0, "bloom filter written");
+    for( size_t j = 0; j < kFrame; ++j )
+    {
+      QuoteQuery q;
+      q.instr_from = q.instr_to = instr(f, j);
+      expect(r.frame_may_match(f, q), "bloom false negative");
+      if( j < 2 )
+        continue;
+      const std::vector<size_t> cand = r.candidate_frames(q);
+      expect(std::find(cand.begin(), cand.end(), f) != cand.end(), "bloom candidate missing");
+      false_pos += cand.size() - 1;
+    }
+  }
+  // ~1% expected at 10 bits per key, 5% leaves room for the line layout
+  expect(false_pos < kFrames * (kFrame - 2) * kFrames / 20, "bloom false positive rate");
+
+  QuoteQuery one;
+  one.instr_from = one.instr_to = instr(42, 7);
+  QuoteColumnBuffer buf;
+  const uint64_t read0 = r.frames_read;
+  expect(r.scan(one, buf, [](uint64_t, uint32_t, int64_t, uint64_t) {}) == 1, "bloom scan hit");
+  expect(r.frames_read - read0 < kFrames / 10, "bloom scan skips frames");
+} );
+
+}
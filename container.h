@@ -0,0 +1,235 @@
+/*
+* container.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "block.h"
+
+namespace RIT::MD
+{
+
+// ---- seekable quote container ----
+// frame 0 .. frame n-1   independent zstd frames, one quote block each
+// index                  n FrameIndexEntry, varint coded, each followed
+//                        by its instrument Bloom filter lines
+// footer                 index offset u64, frame count u32, kContainerMagic u32
+// Each index entry carries min/max of the key columns (zone map), so
+// queries can drop frames before reading or decompressing them.
+
+static constexpr uint32_t kContainerMagic = 0x31465152; // "RQF1"
+static constexpr size_t kContainerFooterSz = 16;
+
+// ---- blocked Bloom filter, one 64-byte line per key ----
+// A key selects one line and sets one bit in each of its 8 words, so a
+// probe touches a single cache line and is a fixed 8-lane AND/compare.
+struct alignas(64) BloomLine
+{
+  uint64_t w[8];
+};
+
+struct BlockedBloom
+{
+  static constexpr size_t kWords = 8;
+
+  static uint64_t hash(uint32_t key) { return uint64_t(key) * 0x9E3779B97F4A7C15ull; }
+
+  static size_t line(uint64_t h, size_t nlines)
+  {
+    return size_t(((h >> 32) * nlines) >> 32);
+  }
+
+  static void masks(uint64_t h, uint64_t (&m)[kWords])
+  {
+    static constexpr uint32_t kSalt[kWords] =
+    {
+      0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+      0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+    };
+    const uint32_t lo = uint32_t(h);
+    for( size_t i = 0; i < kWords; ++i )
+      m[i] = 1ull << ((lo * kSalt[i]) >> 26);
+  }
+
+  static void insert(BloomLine* lines, size_t nlines, uint32_t key)
+  {
+    const uint64_t h = hash(key);
+    uint64_t m[kWords];
+    masks(h, m);
+    BloomLine& l = lines[line(h, nlines)];
+    for( size_t i = 0; i < kWords; ++i )
+      l.w[i] |= m[i];
+  }
+
+  static bool may_contain(const BloomLine* lines, size_t nlines, uint32_t key)
+  {
+    const uint64_t h = hash(key);
+    uint64_t m[kWords];
+    masks(h, m);
+    const BloomLine& l = lines[line(h, nlines)];
+    uint64_t miss = 0;
+    for( size_t i = 0; i < kWords; ++i )
+      miss |= m[i] & ~l.w[i];
+    return miss == 0;
+  }
+};
+
+struct FrameIndexEntry
+{
+  uint64_t offset = 0;
+  uint32_t csize = 0;
+  uint32_t records = 0;
+  uint64_t min_ts = 0;
+  uint64_t max_ts = 0;
+  uint32_t min_instr = 0;
+  uint32_t max_instr = 0;
+  int64_t min_px = 0;
+  int64_t max_px = 0;
+  uint32_t bloom_off = 0; // first line in the owner's bloom array
+  uint32_t bloom_lines = 0; // 0: no filter
+};
+
+// inclusive ranges, defaults match everything
+struct QuoteQuery
+{
+  uint64_t ts_from = 0;
+  uint64_t ts_to = std::numeric_limits<uint64_t>::max();
+  uint32_t instr_from = 0;
+  uint32_t instr_to = std::numeric_limits<uint32_t>::max();
+  int64_t px_from = std::numeric_limits<int64_t>::min();
+  int64_t px_to = std::numeric_limits<int64_t>::max();
+
+  bool may_match(const FrameIndexEntry& e) const
+  {
+    return e.max_ts >= ts_from && e.min_ts <= ts_to
+        && e.max_instr >= instr_from && e.min_instr <= instr_to
+        && e.max_px >= px_from && e.min_px <= px_to;
+  }
+
+  bool matches(uint64_t ts, uint32_t instr, int64_t px) const
+  {
+    return ts >= ts_from && ts <= ts_to
+        && instr >= instr_from && instr <= instr_to
+        && px >= px_from && px <= px_to;
+  }
+};
+
+// zone maps and, if bloom_bits_per_key, a Bloom filter whose lines are
+// appended to bloom (bloom_off is relative to it); offset/csize unset
+FrameIndexEntry make_index_entry(const QuoteColumns& c, size_t n, unsigned bloom_bits_per_key,
+                                 std::vector<uint32_t>& keys, std::vector<BloomLine>& bloom);
+
+// one frame's block <-> its compressed bytes, shared by the container
+// and the transcoder; raw is scratch for the uncompressed block
+void encode_frame(ZSTD_CCtx* cctx, const QuoteColumns& c, size_t n, BlockLayout layout,
+                  std::vector<uint8_t>& raw, std::vector<uint8_t>& comp);
+// throws if the frame claims more than max_raw bytes (corrupt input)
+void decode_frame(ZSTD_DCtx* dctx, const uint8_t* comp, size_t csize, size_t max_raw, std::vector<uint8_t>& raw);
+
+struct SeekableWriter
+{
+  ISink& out;
+  size_t frame_records;
+  int level = 3;
+  ZSTD_CCtx* cctx = nullptr;
+  QuoteColumnBuffer cols;
+  size_t pending = 0;
+  std::vector<uint8_t> raw;
+  std::vector<uint8_t> comp;
+  std::vector<FrameIndexEntry> index;
+  uint64_t offset = 0;
+  unsigned bloom_bits_per_key = 0; // 0: no instrument filters
+  BlockLayout layout = BlockLayout::Columnar;
+  std::vector<BloomLine> bloom;
+  std::vector<uint32_t> keys;
+
+  SeekableWriter(ISink& sink, size_t records_per_frame = 4096, int lvl = 3, unsigned bloom_bits = 0,
+                 BlockLayout lay = BlockLayout::Columnar);
+  ~SeekableWriter();
+  SeekableWriter(const SeekableWriter&) = delete;
+  SeekableWriter& operator=(const SeekableWriter&) = delete;
+
+  void add(uint64_t ts, uint32_t instr, int64_t px, uint64_t sz)
+  {
+    cols.ts[pending] = ts;
+    cols.instr[pending] = instr;
+    cols.px[pending] = px;
+    cols.sz[pending] = sz;
+    if( ++pending == frame_records )
+      flush_frame();
+  }
+
+  void flush_frame(); // closes the current frame early, no-op if empty
+
+  // already compressed frame, e from make_index_entry with e.bloom_lines
+  // lines at `lines` (nullptr if none)
+  void append_frame(const uint8_t* data, size_t csize, FrameIndexEntry e, const BloomLine* lines);
+
+  void finish(); // last frame, index, footer, finishes the sink
+
+private:
+  void write_frame(const uint8_t* data, size_t csize, FrameIndexEntry& e);
+};
+
+struct SeekableReader
+{
+  IRandomSource& src;
+  std::vector<FrameIndexEntry> index;
+  std::vector<BloomLine> bloom;
+  ZSTD_DCtx* dctx = nullptr;
+  std::vector<uint8_t> comp;
+  std::vector<uint8_t> raw;
+  uint64_t frames_read = 0;
+
+  explicit SeekableReader(IRandomSource& source); // reads footer and index
+  ~SeekableReader();
+  SeekableReader(const SeekableReader&) = delete;
+  SeekableReader& operator=(const SeekableReader&) = delete;
+
+  size_t frames() const { return index.size(); }
+
+  // decompressed block bytes of frame i, valid until the next load
+  const std::vector<uint8_t>& load_frame(size_t i);
+
+  // decodes frame i into buf, returns the record count
+  size_t read_frame(size_t i, QuoteColumnBuffer& buf);
+
+  // zone map, plus the Bloom filter for single-instrument queries
+  bool frame_may_match(size_t i, const QuoteQuery& q) const
+  {
+    const FrameIndexEntry& e = index[i];
+    if( !q.may_match(e) )
+      return false;
+    if( q.instr_from != q.instr_to || !e.bloom_lines )
+      return true;
+    return BlockedBloom::may_contain(bloom.data() + e.bloom_off, e.bloom_lines, q.instr_from);
+  }
+
+  // frames that may hold matches, nothing is read
+  std::vector<size_t> candidate_frames(const QuoteQuery& q) const;
+
+  // fn(ts, instr, px, sz) for every matching record, returns the match count
+  template<typename Fn>
+  size_t scan(const QuoteQuery& q, QuoteColumnBuffer& buf, Fn&& fn)
+  {
+    size_t hits = 0;
+    for( size_t i = 0; i < index.size(); ++i )
+    {
+      if( !frame_may_match(i, q) )
+        continue;
+      const size_t n = read_frame(i, buf);
+      for( size_t j = 0; j < n; ++j )
+      {
+        if( !q.matches(buf.ts[j], buf.instr[j], buf.px[j]) )
+          continue;
+        fn(buf.ts[j], buf.instr[j], buf.px[j], buf.sz[j]);
+        ++hits;
+      }
+    }
+    return hits;
+  }
+};
+
+}
@@ -0,0 +1,264 @@
+/*
+* datagram.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "datagram.h"
+#include <cerrno>
+#include <system_error>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+DatagramHeader parse_datagram(const uint8_t* data, size_t n, const uint8_t*& payload)
+{
+  if( n < kDatagramHeaderSz )
+    throw std::runtime_error("datagram too short");
+  DatagramHeader h;
+  h.seq = uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+  h.reset = DeltaReset(data[4]);
+  h.len = uint16_t(data[6] | data[7] << 8);
+  if( h.len != n - kDatagramHeaderSz )
+    throw std::runtime_error("datagram length mismatch");
+  payload = data + kDatagramHeaderSz;
+  return h;
+}
+
+DatagramSink::DatagramSink(int sock, size_t mtu_bytes, DeltaReset r)
+:
+  fd{ sock },
+  mtu{ mtu_bytes },
+  reset{ r }
+{
+  if( mtu <= kDatagramHeaderSz || mtu - kDatagramHeaderSz > 0xFFFF )
+    throw std::invalid_argument("bad datagram mtu");
+  slab.resize(kBatch * mtu);
+}
+
+void DatagramSink::write(const uint8_t* data, size_t n)
+{
+  if( cur + n > payload_cap() )
+    throw std::length_error("datagram payload overflow");
+  std::memcpy(slab.data() + npk * mtu + kDatagramHeaderSz + cur, data, n);
+  cur += n;
+}
+
+void DatagramSink::close_packet()
+{
+  if( !cur )
+    return;
+
+  uint8_t* p = slab.data() + npk * mtu;
+  p[0] = uint8_t(seq);
+  p[1] = uint8_t(seq >> 8);
+  p[2] = uint8_t(seq >> 16);
+  p[3] = uint8_t(seq >> 24);
+  p[4] = uint8_t(reset);
+  p[5] = 0;
+  p[6] = uint8_t(cur);
+  p[7] = uint8_t(cur >> 8);
+  lens[npk++] = kDatagramHeaderSz + cur;
+  ++seq;
+  cur = 0;
+
+  if( npk == kBatch )
+    send_batch();
+}
+
+void DatagramSink::flush()
+{
+  close_packet();
+  send_batch();
+}
+
+void DatagramSink::finish()
+{
+  flush();
+}
+
+void DatagramSink::send_batch()
+{
+  if( !npk )
+    return;
+  std::array<iovec, kBatch> iov{};
+  std::array<mmsghdr, kBatch> msgs{};
+  for( size_t i = 0; i < npk; ++i )
+  {
+    iov[i].iov_base = slab.data() + i * mtu;
+    iov[i].iov_len = lens[i];
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  size_t sent = 0;
+  while( sent < npk )
+  {
+    const int rc = ::sendmmsg(fd, msgs.data() + sent, unsigned(npk - sent), 0);
+    if( rc < 0 )
+    {
+      if( errno == EINTR )
+        continue;
+      throw std::system_error(errno, std::generic_category(), "sendmmsg");
+    }
+    sent += size_t(rc);
+  }
+  packets_sent += npk;
+  npk = 0;
+}
+
+DatagramPacker::DatagramPacker(DatagramSink& s)
+:
+  sink{ s },
+  w{ s }
+{
+}
+
+void DatagramPacker::end_packet()
+{
+  w.align_to_byte();
+  w.drain();
+  sink.close_packet();
+  packet_begin = w.bits_written();
+  fresh = true;
+}
+
+void DatagramPacker::flush()
+{
+  if( !fresh )
+    end_packet();
+  sink.flush();
+}
+
+void DatagramPacker::finish()
+{
+  w.finish();
+  packet_begin = w.bits_written();
+  fresh = true;
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+// packs over loopback UDP under both reset policies, every packet must
+// arrive in order and decode with only the state its header promises
+static int reg1 = add_test( []()
+{
+  for( const DeltaReset policy : { DeltaReset::PerPacket, DeltaReset::None } )
+  {
+    const int rx = ::socket(AF_INET, SOCK_DGRAM, 0);
+    const int tx = ::socket(AF_INET, SOCK_DGRAM, 0);
+    expect(rx >= 0 && tx >= 0, "socket");
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t al = sizeof(a);
+    expect(::bind(rx, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0, "bind");
+    expect(::getsockname(rx, reinterpret_cast<sockaddr*>(&a), &al) == 0, "getsockname");
+    expect(::connect(tx, reinterpret_cast<sockaddr*>(&a), sizeof(a)) == 0, "connect");
+
+    static constexpr size_t kMtu = 256;
+    static constexpr uint64_t kRecords = 2000;
+    DatagramSink sink(tx, kMtu, policy);
+    DatagramPacker pk(sink);
+    uint64_t prev = 0;
+    const auto value = [](uint64_t i) { return 1000000 + i * 17 + (i % 7); };
+    const auto encode_range = [&](uint64_t b, uint64_t e)
+    {
+      for( uint64_t i = b; i < e; ++i )
+      {
+        pk.add([&](BufferedBitWriter& w, bool packet_start)
+        {
+          w.put_var(value(i), packet_start ? 0 : prev);
+          w.put(i, 20);
+        });
+        prev = value(i);
+      }
+    };
+
+    uint8_t buf[kMtu];
+    uint64_t got = 0;
+    uint32_t seq = 0;
+    uint64_t base = 0;
+    const auto drain = [&]()
+    {
+      for( ;; )
+      {
+        const ssize_t n = ::recv(rx, buf, sizeof(buf), MSG_DONTWAIT);
+        if( n < 0 )
+          return;
+        const uint8_t* pl;
+        const DatagramHeader h = parse_datagram(buf, size_t(n), pl);
+        expect(h.seq == seq++, "datagram sequence");
+        expect(h.reset == policy, "datagram reset policy");
+        if( h.reset == DeltaReset::PerPacket )
+          base = 0;
+        BitReader r(pl, pl + h.len);
+        // records are at least 3 bytes, the pad is under one
+        while( uint64_t(r.end - r.p) * 8 + r.bits >= 24 )
+        {
+          base += r.get_var64();
+          expect(base == value(got), "datagram value");
+          expect(r.get(20) == (got & 0xFFFFF), "datagram field");
+          ++got;
+        }
+      }
+    };
+
+    // a few records and a flush must go out without waiting for a batch
+    encode_range(0, 5);
+    pk.flush();
+    drain();
+    expect(got == 5, "datagram flush");
+
+    // a record larger than the writer buffer, one larger than a packet
+    // and a throwing encoder must each leave the packer usable
+    const auto expect_throws = [&](auto&& encode, const char* msg, const char* what)
+    {
+      std::string err;
+      try
+      {
+        pk.add(encode);
+      }
+      catch( const std::exception& e )
+      {
+        err = e.what();
+      }
+      expect(err == msg && !pk.w.pinned, what);
+    };
+    expect_throws([](BufferedBitWriter& w, bool)
+    {
+      for( size_t i = 0; i < 70000; ++i )
+        w.put(0xA5, 8);
+    }, "record exceeds datagram payload", "datagram oversized record");
+    expect_throws([](BufferedBitWriter& w, bool)
+    {
+      for( size_t i = 0; i < kMtu; ++i )
+        w.put(0xA5, 8);
+    }, "record exceeds datagram payload", "datagram record over payload");
+    expect_throws([](BufferedBitWriter& w, bool)
+    {
+      w.put(0xA5, 8);
+      throw std::runtime_error("encode failed");
+    }, "encode failed", "datagram throwing encoder");
+
+    encode_range(5, kRecords);
+    pk.finish();
+    drain();
+    expect(got == kRecords, "datagram records");
+    expect(sink.packets_sent == seq, "datagram packet count");
+
+    ::close(tx);
+    ::close(rx);
+  }
+} );
+
+}
@@ -0,0 +1,136 @@
+/*
+* datagram.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+
+namespace RIT::MD
+{
+
+// ---- record-aligned datagram packing ----
+// Every datagram is
+//   seq u32, reset policy u8, reserved u8, payload length u16 (LE)
+//   payload: whole records, bit-packed, padded to a byte
+// With DeltaReset::PerPacket the encoder resets its delta state at the
+// start of each payload, so any packet decodes on its own.
+
+enum class DeltaReset : uint8_t
+{
+  None = 0,
+  PerPacket = 1,
+};
+
+struct DatagramHeader
+{
+  uint32_t seq = 0;
+  DeltaReset reset = DeltaReset::None;
+  uint16_t len = 0;
+};
+
+static constexpr size_t kDatagramHeaderSz = 8;
+
+// header and payload of a received datagram, throws on a malformed one
+DatagramHeader parse_datagram(const uint8_t* data, size_t n, const uint8_t*& payload);
+
+// Collects writes into the current packet, close_packet() queues it.
+// Queued packets go out in one sendmmsg on a connected datagram socket
+// once kBatch are queued, or on flush()/finish().
+struct DatagramSink final : ISink
+{
+  static constexpr size_t kBatch = 32;
+
+  int fd = -1;
+  size_t mtu = 0; // datagram size including header
+  DeltaReset reset = DeltaReset::PerPacket;
+  uint32_t seq = 0;
+  std::vector<uint8_t> slab; // kBatch packets of mtu bytes
+  std::array<size_t, kBatch> lens{};
+  size_t npk = 0; // closed packets in slab
+  size_t cur = 0; // payload bytes in the open packet
+  uint64_t packets_sent = 0;
+
+  DatagramSink(int sock, size_t mtu_bytes = 1472, DeltaReset r = DeltaReset::PerPacket);
+
+  size_t payload_cap() const { return mtu - kDatagramHeaderSz; }
+
+  void close_packet(); // queues the open packet, if any
+  void write(const uint8_t* data, size_t n) override; // throws past payload_cap
+  void flush() override; // closes the open packet, sends the queue
+  void finish() override;
+
+  void send_batch();
+};
+
+// Drives a BufferedBitWriter over a DatagramSink: a record is encoded
+// once under a checkpoint, and if it overflows the packet it is rolled
+// back and re-encoded at the start of a fresh packet.
+struct DatagramPacker
+{
+  DatagramSink& sink;
+  BufferedBitWriter w;
+  uint64_t packet_begin = 0; // bits_written() at packet start
+  bool fresh = true; // next record opens a packet
+
+  explicit DatagramPacker(DatagramSink& s);
+
+  // encode(w, packet_start) writes one record, packet_start means delta
+  // state must be reset first (only ever set with DeltaReset::PerPacket).
+  // encode may run twice for a record that moved to a new packet, so it
+  // must not commit delta state itself; do that once add() returns.
+  template<typename EncodeFn>
+  void add(EncodeFn&& encode)
+  {
+    if( try_add(encode) )
+      return;
+    if( fresh )
+      throw std::length_error("record exceeds datagram payload");
+    end_packet();
+    if( !try_add(encode) )
+      throw std::length_error("record exceeds datagram payload");
+  }
+
+  void end_packet(); // pads and queues the open packet
+  void flush(); // ends the open packet and sends the queue
+  void finish(); // last packet, finishes the sink
+
+private:
+  template<typename EncodeFn>
+  bool try_add(EncodeFn& encode)
+  {
+    const size_t cap = sink.payload_cap();
+    w.pin(cap);
+    const BufferedBitWriter::Checkpoint cp = w.checkpoint();
+    try
+    {
+      encode(w, fresh && sink.reset == DeltaReset::PerPacket);
+    }
+    catch( const std::length_error& )
+    {
+      // the record outgrew the pinned buffer, so it can't fit a packet
+      w.rollback(cp);
+      w.unpin();
+      throw std::length_error("record exceeds datagram payload");
+    }
+    catch( ... )
+    {
+      w.rollback(cp);
+      w.unpin();
+      throw;
+    }
+    if( ((w.bits_written() - packet_begin + 7) >> 3) > cap )
+    {
+      w.rollback(cp);
+      w.unpin();
+      return false;
+    }
+    w.unpin();
+    fresh = false;
+    return true;
+  }
+};
+
+}
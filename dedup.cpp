@@ -0,0 +1,151 @@
+/*
+* dedup.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "dedup.h"
+#include <random>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+uint64_t hash_bytes(const uint8_t* data, size_t n)
+{
+  static constexpr uint64_t kMul = 0x9E3779B97F4A7C15ull;
+  uint64_t h = kMul ^ n;
+  for( ; n >= 8; data += 8, n -= 8 )
+  {
+    uint64_t w;
+    std::memcpy(&w, data, 8);
+    h = (h ^ w) * kMul;
+    h ^= h >> 29;
+  }
+  if( n )
+  {
+    uint64_t w = 0;
+    std::memcpy(&w, data, n);
+    h = (h ^ w) * kMul;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+DedupEncoder::DedupEncoder(BufferedBitWriter& writer)
+:
+  w{ writer }
+{
+}
+
+bool DedupEncoder::put_record(const uint8_t* data, size_t n)
+{
+  const uint64_t h = hash_bytes(data, n);
+  for( size_t i = 0; i < ring.used; ++i )
+  {
+    if( ring.hashes[i] != h )
+      continue;
+    const std::vector<uint8_t>& rec = ring.recs[i];
+    if( rec.size() != n || ( n && std::memcmp(rec.data(), data, n) != 0 ) )
+      continue;
+
+    w.put_var(uint64_t(i) << 1 | 1);
+    ++hits;
+    return true;
+  }
+
+  w.put_var(uint64_t(n) << 1);
+  w.put_bytes(data, n);
+  ring.push(h, data, n);
+  return false;
+}
+
+DedupDecoder::DedupDecoder(BitReader& reader)
+:
+  r{ reader }
+{
+}
+
+const std::vector<uint8_t>& DedupDecoder::get_record()
+{
+  const uint64_t v = r.get_var64();
+  if( v & 1 )
+  {
+    const uint64_t i = v >> 1;
+    if( i >= ring.used )
+      throw std::runtime_error("bad dedup reference");
+    return ring.recs[i];
+  }
+
+  const uint64_t n = v >> 1;
+  if( n > uint64_t(r.end - r.p) + r.bits / 8 )
+    throw std::runtime_error("bitstream underflow");
+  std::vector<uint8_t>& rec = ring.recs[ring.next];
+  rec.resize(n);
+  r.get_bytes(rec.data(), n);
+  ring.next = (ring.next + 1) & (DedupRing::kSlots - 1);
+  if( ring.used < DedupRing::kSlots )
+    ++ring.used;
+  return rec;
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+// random repeats from a small pool (with the empty record) decode to the
+// same records, aligned or not, and a hash match with different bytes
+// stays a literal
+static int reg1 = add_test( []()
+{
+  std::mt19937_64 g(52);
+  std::vector<std::vector<uint8_t>> pool(24);
+  for( size_t i = 1; i < pool.size(); ++i )
+  {
+    pool[i].resize(g() % 40);
+    for( uint8_t& b : pool[i] )
+      b = uint8_t(g());
+  }
+
+  for( const unsigned lead : { 0u, 3u } )
+  {
+    std::vector<uint8_t> out;
+    std::vector<size_t> picks;
+    uint64_t hits = 0;
+    {
+      VectorSink vs(out);
+      BufferedBitWriter w(vs);
+      w.put(5, lead);
+      DedupEncoder enc(w);
+      for( size_t k = 0; k < 2000; ++k )
+      {
+        picks.push_back(g() % pool.size());
+        enc.put_record(pool[picks.back()]);
+      }
+
+      // the last literal's slot claims the next record's hash
+      const std::vector<uint8_t> a{ 1, 2, 3 };
+      const std::vector<uint8_t> b{ 1, 2, 4 };
+      expect(!enc.put_record(a), "dedup literal");
+      enc.ring.hashes[(enc.ring.next - 1) & (DedupRing::kSlots - 1)] = hash_bytes(b.data(), b.size());
+      expect(!enc.put_record(b), "dedup hash collision");
+      expect(enc.put_record(b), "dedup repeat");
+      hits = enc.hits;
+      w.finish();
+    }
+    expect(hits > 1000, "dedup hit rate");
+
+    BitReader r(out.data(), out.data() + out.size());
+    expect(r.get(lead) == (5 & ((1u << lead) - 1)), "dedup lead bits");
+    DedupDecoder dec(r);
+    for( size_t i : picks )
+      expect(dec.get_record() == pool[i], "dedup record");
+    expect(dec.get_record() == std::vector<uint8_t>{ 1, 2, 3 }, "dedup literal a");
+    expect(dec.get_record() == std::vector<uint8_t>{ 1, 2, 4 }, "dedup collision b");
+    expect(dec.get_record() == std::vector<uint8_t>{ 1, 2, 4 }, "dedup repeat b");
+  }
+} );
+
+}
@@ -0,0 +1,67 @@
+/*
+* dedup.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+
+namespace RIT::MD
+{
+
+// ---- record-level dedup stage ----
+// Each record is an already encoded byte string. Wire format per record:
+//   put_var(len << 1), len bytes : literal
+//   put_var(slot << 1 | 1)       : back-reference to an earlier literal
+// Records are whole bytes, so on a byte-aligned stream literals are copied
+// with memcpy in both directions.
+// Encoder and decoder keep identical rings of the last kSlots literals.
+struct DedupRing
+{
+  static constexpr unsigned kSlotBits = 4;
+  static constexpr size_t kSlots = size_t(1) << kSlotBits;
+
+  std::array<uint64_t, kSlots> hashes{};
+  std::array<std::vector<uint8_t>, kSlots> recs{}; // capacity reused
+  size_t next = 0;
+  size_t used = 0;
+
+  void push(uint64_t h, const uint8_t* data, size_t n)
+  {
+    hashes[next] = h;
+    recs[next].assign(data, data + n);
+    next = (next + 1) & (kSlots - 1);
+    if( used < kSlots )
+      ++used;
+  }
+};
+
+uint64_t hash_bytes(const uint8_t* data, size_t n);
+
+struct DedupEncoder
+{
+  BufferedBitWriter& w;
+  DedupRing ring;
+  uint64_t hits = 0;
+
+  explicit DedupEncoder(BufferedBitWriter& writer);
+
+  // returns true if the record was emitted as a back-reference
+  bool put_record(const uint8_t* data, size_t n);
+  bool put_record(const std::vector<uint8_t>& rec) { return put_record(rec.data(), rec.size()); }
+};
+
+struct DedupDecoder
+{
+  BitReader& r;
+  DedupRing ring;
+
+  explicit DedupDecoder(BitReader& reader);
+
+  // bytes stay valid until kSlots further literals are read
+  const std::vector<uint8_t>& get_record();
+};
+
+}
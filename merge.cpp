@@ -0,0 +1,194 @@
+/*
+* merge.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "merge.h"
+#include <random>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+struct MergeCursor
+{
+  SeekableReader* reader = nullptr;
+  QuoteColumnBuffer buf;
+  size_t frame = 0;
+  size_t pos = 0;
+  size_t n = 0;
+  bool done = false;
+
+  uint64_t ts() const { return buf.ts[pos]; }
+
+  // moves to the next record, loading frames as needed
+  void advance()
+  {
+    if( ++pos < n )
+      return;
+    pos = 0;
+    n = 0;
+    while( !n && frame < reader->frames() )
+      n = reader->read_frame(frame++, buf);
+    done = !n;
+  }
+};
+
+// tree[0] holds the winner, tree[1..k-1] the loser of each internal node,
+// leaves are implicit nodes k..2k-1
+struct LoserTree
+{
+  const std::vector<MergeCursor>& cur;
+  std::vector<uint32_t> tree;
+
+  explicit LoserTree(const std::vector<MergeCursor>& c)
+  :
+    cur{ c },
+    tree( c.size() )
+  {
+    if( !cur.empty() )
+      tree[0] = build(1);
+  }
+
+  bool less(uint32_t a, uint32_t b) const
+  {
+    if( cur[a].done )
+      return false;
+    if( cur[b].done )
+      return true;
+    const uint64_t ta = cur[a].ts();
+    const uint64_t tb = cur[b].ts();
+    return ta < tb || (ta == tb && a < b);
+  }
+
+  uint32_t build(size_t node)
+  {
+    const size_t k = cur.size();
+    if( node >= k )
+      return uint32_t(node - k);
+    const uint32_t l = build(2 * node);
+    const uint32_t r = build(2 * node + 1);
+    if( less(l, r) )
+    {
+      tree[node] = r;
+      return l;
+    }
+    tree[node] = l;
+    return r;
+  }
+
+  // leaf changed key, replays its path to the root
+  void replay(uint32_t leaf)
+  {
+    uint32_t w = leaf;
+    for( size_t node = (leaf + cur.size()) / 2; node >= 1; node /= 2 )
+      if( less(tree[node], w) )
+        std::swap(tree[node], w);
+    tree[0] = w;
+  }
+
+  uint32_t winner() const { return tree[0]; }
+};
+
+uint64_t merge_containers(const std::vector<SeekableReader*>& inputs, SeekableWriter& out)
+{
+  if( inputs.empty() )
+    return 0;
+
+  std::vector<MergeCursor> cur(inputs.size());
+  for( size_t i = 0; i < inputs.size(); ++i )
+  {
+    cur[i].reader = inputs[i];
+    cur[i].advance(); // loads the first frame
+  }
+
+  LoserTree lt(cur);
+  uint64_t written = 0;
+  for( ;; )
+  {
+    const uint32_t w = lt.winner();
+    MergeCursor& c = cur[w];
+    if( c.done )
+      break;
+    out.add(c.buf.ts[c.pos], c.buf.instr[c.pos], c.buf.px[c.pos], c.buf.sz[c.pos]);
+    ++written;
+    c.advance();
+    lt.replay(w);
+  }
+  return written;
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+// k inputs with many equal ts, one of them empty: the output is sorted,
+// equal ts come out in input order and nothing is lost
+static int reg1 = add_test( []()
+{
+  std::mt19937_64 g(62);
+  for( const size_t k : { 1, 2, 3, 5, 7, 8 } )
+  {
+    std::vector<std::vector<uint8_t>> files(k);
+    size_t total = 0;
+    for( size_t i = 0; i < k; ++i )
+    {
+      VectorSink vs(files[i]);
+      SeekableWriter w(vs, 16);
+      // input 1 stays empty when there are several
+      const size_t n = (k > 1 && i == 1) ? 0 : 50 + g() % 200;
+      uint64_t ts = g() % 4;
+      for( size_t j = 0; j < n; ++j )
+      {
+        ts += g() % 3;
+        w.add(ts, uint32_t(i), int64_t(j), 1);
+      }
+      w.finish();
+      total += n;
+    }
+
+    std::vector<std::unique_ptr<MemorySource>> srcs;
+    std::vector<std::unique_ptr<SeekableReader>> readers;
+    std::vector<SeekableReader*> inputs;
+    for( std::vector<uint8_t>& f : files )
+    {
+      srcs.push_back(std::make_unique<MemorySource>(f.data(), f.size()));
+      readers.push_back(std::make_unique<SeekableReader>(*srcs.back()));
+      inputs.push_back(readers.back().get());
+    }
+
+    std::vector<uint8_t> res;
+    {
+      VectorSink vs(res);
+      SeekableWriter out(vs, 64);
+      expect(merge_containers(inputs, out) == total, "merge returned count");
+      out.finish();
+    }
+
+    MemorySource rs(res.data(), res.size());
+    SeekableReader r(rs);
+    QuoteColumnBuffer buf;
+    std::vector<int64_t> next(k, 0);
+    uint64_t prev_ts = 0;
+    uint32_t prev_in = 0;
+    size_t got = 0;
+    for( size_t f = 0; f < r.frames(); ++f )
+    {
+      const size_t n = r.read_frame(f, buf);
+      for( size_t j = 0; j < n; ++j, ++got )
+      {
+        const uint32_t in = buf.instr[j];
+        expect(in < k && buf.px[j] == next[in]++, "merge input order");
+        expect(!got || buf.ts[j] > prev_ts || (buf.ts[j] == prev_ts && in >= prev_in), "merge ts order");
+        prev_ts = buf.ts[j];
+        prev_in = in;
+      }
+    }
+    expect(got == total, "merge record count");
+  }
+} );
+
+}
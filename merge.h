@@ -0,0 +1,20 @@
+/*
+* merge.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "container.h"
+
+namespace RIT::MD
+{
+
+// ---- streaming k-way merge of time-sorted captures ----
+// Each input is walked frame by frame, so memory stays at one decoded
+// frame per input plus the output frame. Records with equal ts keep
+// input order. Returns the number of records written; out is not finished.
+uint64_t merge_containers(const std::vector<SeekableReader*>& inputs, SeekableWriter& out);
+
+}
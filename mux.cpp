@@ -0,0 +1,207 @@
+/*
+* mux.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "mux.h"
+#include <random>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+StreamMux::StreamMux(ISink& downstream)
+:
+  down{ downstream }
+{
+}
+
+void StreamMux::put_chunk(uint32_t id, const uint8_t* data, size_t n)
+{
+  if( !n )
+    return;
+  uint8_t hdr[16];
+  SpanBitWriter<false> h{ std::span<uint8_t>(hdr) };
+  h.put_var(id);
+  h.put_var(uint64_t(n));
+  down.write(hdr, h.finish());
+  down.write(data, n);
+  ++chunks;
+  bytes += n;
+}
+
+MuxChannel::MuxChannel(StreamMux& m, uint32_t stream_id)
+:
+  mux{ m },
+  id{ stream_id }
+{
+}
+
+void MuxChannel::write(const uint8_t* data, size_t n)
+{
+  mux.put_chunk(id, data, n);
+}
+
+MuxStream::MuxStream(StreamMux& m, uint32_t stream_id, size_t capacity)
+:
+  ch{ m, stream_id },
+  w{ ch, capacity }
+{
+}
+
+// byte-aligned LEB128, false if the input ends first
+static bool read_var(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+{
+  v = 0;
+  for( unsigned sh = 0; p != end; sh += 7 )
+  {
+    if( sh > 63 )
+      throw std::runtime_error("mux varint overflow");
+    const uint8_t b = *p++;
+    v |= uint64_t(b & 0x7F) << sh;
+    if( !(b & 0x80) )
+      return true;
+  }
+  return false;
+}
+
+void StreamDemux::write(const uint8_t* data, size_t n)
+{
+  if( !tail.empty() )
+  {
+    tail.insert(tail.end(), data, data + n);
+    data = tail.data();
+    n = tail.size();
+  }
+
+  const uint8_t* p = data;
+  const uint8_t* end = data + n;
+  for( ;; )
+  {
+    const uint8_t* q = p;
+    uint64_t id, len;
+    if( !read_var(q, end, id) || !read_var(q, end, len) || uint64_t(end - q) < len )
+      break;
+    if( id > UINT32_MAX )
+      throw std::runtime_error("mux stream id out of range");
+    std::vector<uint8_t>& s = streams[uint32_t(id)];
+    s.insert(s.end(), q, q + len);
+    p = q + len;
+  }
+
+  if( p == end )
+    tail.clear();
+  else if( data == tail.data() )
+    tail.erase(tail.begin(), tail.begin() + (p - data));
+  else
+    tail.assign(p, end);
+}
+
+void StreamDemux::finish()
+{
+  if( !tail.empty() )
+    throw std::runtime_error("mux truncated chunk");
+}
+
+BitReader StreamDemux::reader(uint32_t id) const
+{
+  const auto it = streams.find(id);
+  if( it == streams.end() )
+    throw std::out_of_range("mux unknown stream");
+  const std::vector<uint8_t>& s = it->second;
+  return BitReader(s.data(), s.data() + s.size());
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+// interleaved streams through zstd and back, with the compressed bytes,
+// the decompressor output and the raw mux bytes all cut at random, so
+// chunks and their headers straddle write() calls
+static int reg1 = add_test( []()
+{
+  static constexpr uint32_t kStreams = 40;
+  std::mt19937_64 g(71);
+  std::vector<std::vector<uint64_t>> sent(kStreams);
+  std::vector<uint8_t> z;
+  uint64_t payload = 0;
+  {
+    VectorSink zs(z);
+    ZstdStreamCompressor c(zs, 3, 512);
+    StreamMux mux(c);
+    std::vector<std::unique_ptr<MuxStream>> streams;
+    for( uint32_t id = 0; id < kStreams; ++id )
+      streams.push_back(std::make_unique<MuxStream>(mux, id * 1000, 16 + id % 5 * 64));
+    for( unsigned i = 0; i < 50000; ++i )
+    {
+      const uint32_t s = uint32_t(g() % kStreams);
+      const uint64_t v = g() >> (g() % 64);
+      streams[s]->w.put_var(v);
+      sent[s].push_back(v);
+      if( i % 10000 == 0 )
+        mux.flush();
+    }
+    for( auto& s : streams )
+      s->w.finish();
+    mux.finish();
+    payload = mux.bytes;
+  }
+
+  const auto check = [&](const StreamDemux& d)
+  {
+    uint64_t total = 0;
+    for( uint32_t id = 0; id < kStreams; ++id )
+    {
+      BitReader r = d.reader(id * 1000);
+      for( uint64_t v : sent[id] )
+        expect(r.get_var64() == v, "mux stream value");
+      expect(r.p == r.end && r.bits == 0, "mux stream length");
+      total += d.streams.at(id * 1000).size();
+    }
+    expect(total == payload && d.streams.size() == kStreams, "mux streams");
+  };
+
+  StreamDemux dz;
+  std::vector<uint8_t> raw;
+  VectorSink rs(raw);
+  ZstdStreamDecompressor dec(dz, 100), dec_raw(rs);
+  for( size_t off = 0; off < z.size(); )
+  {
+    const size_t n = std::min<size_t>(z.size() - off, 1 + g() % 300);
+    dec.write(z.data() + off, n);
+    dec_raw.write(z.data() + off, n);
+    off += n;
+  }
+  dec.finish();
+  dec_raw.finish();
+  check(dz);
+
+  StreamDemux dr;
+  for( size_t off = 0; off < raw.size(); )
+  {
+    const size_t n = std::min<size_t>(raw.size() - off, g() % 8);
+    dr.write(raw.data() + off, n);
+    off += n;
+  }
+  dr.finish();
+  check(dr);
+
+  StreamDemux cut;
+  cut.write(raw.data(), raw.size() - 1);
+  bool threw = false;
+  try
+  {
+    cut.finish();
+  }
+  catch( const std::runtime_error& )
+  {
+    threw = true;
+  }
+  expect(threw, "mux truncated chunk");
+} );
+
+}
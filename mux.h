@@ -0,0 +1,75 @@
+/*
+* mux.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+#include <unordered_map>
+
+namespace RIT::MD
+{
+
+// ---- many low-rate streams over one shared sink ----
+// Each stream is a small-buffer writer whose spills become tagged chunks
+//   put_var(stream id), put_var(len), len bytes
+// on the shared sink (typically one ZstdStreamCompressor). A stream's
+// chunks concatenated in order are exactly its own byte stream.
+struct StreamMux
+{
+  ISink& down;
+  uint64_t chunks = 0;
+  uint64_t bytes = 0; // payload bytes, without chunk headers
+
+  explicit StreamMux(ISink& downstream);
+
+  void put_chunk(uint32_t id, const uint8_t* data, size_t n);
+  void flush() { down.flush(); }
+  void finish() { down.finish(); }
+};
+
+// per-stream sink: flush/finish only hand bytes to the mux, the shared
+// sink is flushed through StreamMux
+struct MuxChannel final : ISink
+{
+  StreamMux& mux;
+  uint32_t id;
+
+  MuxChannel(StreamMux& m, uint32_t stream_id);
+  void write(const uint8_t* data, size_t n) override;
+  void flush() override {}
+  void finish() override {}
+};
+
+// one logical stream: writer + channel, a few hundred bytes with the
+// default buffer. Not movable, the writer refers to the channel.
+struct MuxStream
+{
+  static constexpr size_t kDefaultCap = 256;
+
+  MuxChannel ch;
+  BufferedBitWriter w;
+
+  MuxStream(StreamMux& m, uint32_t stream_id, size_t capacity = kDefaultCap);
+  MuxStream(const MuxStream&) = delete;
+  MuxStream& operator=(const MuxStream&) = delete;
+};
+
+// Splits a muxed byte stream (e.g. the decompressed output) back into per
+// stream buffers; chunks may straddle write() calls.
+struct StreamDemux final : ISink
+{
+  std::unordered_map<uint32_t, std::vector<uint8_t>> streams;
+  std::vector<uint8_t> tail; // incomplete chunk from the last write
+
+  void write(const uint8_t* data, size_t n) override;
+  void flush() override {}
+  void finish() override; // throws on a truncated chunk
+
+  // reader over everything received for id, throws on unknown id
+  BitReader reader(uint32_t id) const;
+};
+
+}
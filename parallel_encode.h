@@ -0,0 +1,75 @@
+/*
+* parallel_encode.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+#include "pipeline.h"
+#include <latch>
+#include <memory>
+
+namespace RIT::MD
+{
+
+// ---- parallel encode of one logical stream ----
+// Records [0, n) are cut into chunks of `chunk` records. Each chunk is
+// encoded on the pool by encode(w, begin, end) into its own writer, with
+// delta state reset at `begin`, then spliced into `out` in order, so the
+// result is one continuous bitstream. At most 2 * pool.size() chunks are
+// held at once.
+template<typename EncodeFn>
+void encode_chunked(BufferedBitWriter& out, size_t n, size_t chunk, ThreadPool& pool, EncodeFn encode)
+{
+  struct Chunk
+  {
+    std::vector<uint8_t> bytes;
+    uint64_t nbits = 0;
+    std::exception_ptr error;
+  };
+
+  if( !chunk )
+    throw std::invalid_argument("chunk must be positive");
+
+  const size_t wave = 2 * pool.size();
+  std::vector<Chunk> chunks(wave);
+  for( size_t first = 0; first < n; first += wave * chunk )
+  {
+    const size_t count = std::min(wave, (n - first + chunk - 1) / chunk);
+    std::latch done{ ptrdiff_t(count) };
+    for( size_t c = 0; c < count; ++c )
+    {
+      pool.submit([&, c]
+      {
+        Chunk& ch = chunks[c];
+        try
+        {
+          const size_t begin = first + c * chunk;
+          ch.bytes.clear();
+          VectorSink vs(ch.bytes);
+          auto w = std::make_unique<BufferedBitWriter>(vs);
+          encode(*w, begin, std::min(n, begin + chunk));
+          ch.nbits = w->bits_written();
+          w->finish();
+        }
+        catch( ... )
+        {
+          ch.error = std::current_exception();
+        }
+        done.count_down();
+      });
+    }
+    done.wait();
+
+    for( size_t c = 0; c < count; ++c )
+    {
+      if( chunks[c].error )
+        std::rethrow_exception(chunks[c].error);
+      out.splice(chunks[c].bytes.data(), chunks[c].nbits);
+    }
+  }
+}
+
+}
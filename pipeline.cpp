@@ -0,0 +1,152 @@
+/*
+* pipeline.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "pipeline.h"
+#include "parallel_encode.h"
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+ThreadPool::ThreadPool(size_t threads)
+{
+  if( !threads )
+    threads = 1;
+  workers.reserve(threads);
+  for( size_t i = 0; i < threads; ++i )
+    workers.emplace_back([this] { run(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lk(m);
+    stop = true;
+  }
+  has_task.notify_all();
+  for( std::thread& t : workers )
+    t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lk(m);
+    tasks.push_back(std::move(task));
+  }
+  has_task.notify_one();
+}
+
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lk(m);
+  idle.wait(lk, [&] { return tasks.empty() && !active; });
+  if( error )
+  {
+    std::exception_ptr e = error;
+    error = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+void ThreadPool::run()
+{
+  for( ;; )
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lk(m);
+      has_task.wait(lk, [&] { return stop || !tasks.empty(); });
+      if( tasks.empty() )
+        return;
+      task = std::move(tasks.front());
+      tasks.pop_front();
+      ++active;
+    }
+
+    std::exception_ptr e;
+    try
+    {
+      task();
+    }
+    catch( ... )
+    {
+      e = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lk(m);
+    if( e && !error )
+      error = e;
+    if( !--active && tasks.empty() )
+      idle.notify_all();
+  }
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+// chunked encoding after an unaligned prefix equals encoding the same
+// chunks serially; the chunk size is not a multiple of the wave, and a
+// failing chunk's exception reaches the caller
+static int reg1 = add_test( []()
+{
+  static constexpr size_t kRecords = 5000;
+  static constexpr size_t kChunk = 37;
+  const auto value = [](size_t i) { return int64_t(i * 7919 % 1000) - 500 + int64_t(i) * 3; };
+  const auto encode = [&](BufferedBitWriter& w, size_t begin, size_t end)
+  {
+    int64_t prev = 0;
+    for( size_t i = begin; i < end; ++i )
+    {
+      prev = w.put_var_sign_zero(value(i), prev);
+      w.put(i, 13);
+    }
+  };
+
+  ThreadPool pool(3);
+  std::vector<uint8_t> serial, chunked;
+  {
+    VectorSink vs(serial);
+    BufferedBitWriter w(vs);
+    w.put(5, 3);
+    for( size_t b = 0; b < kRecords; b += kChunk )
+      encode(w, b, std::min(kRecords, b + kChunk));
+    w.finish();
+  }
+  {
+    VectorSink vs(chunked);
+    BufferedBitWriter w(vs);
+    w.put(5, 3);
+    encode_chunked(w, kRecords, kChunk, pool, encode);
+    w.finish();
+  }
+  expect(serial == chunked, "encode_chunked vs serial");
+
+  std::string err;
+  try
+  {
+    std::vector<uint8_t> out;
+    VectorSink vs(out);
+    BufferedBitWriter w(vs);
+    encode_chunked(w, kRecords, kChunk, pool, [&](BufferedBitWriter& cw, size_t begin, size_t end)
+    {
+      if( begin == 20 * kChunk )
+        throw std::runtime_error("chunk failed");
+      encode(cw, begin, end);
+    });
+  }
+  catch( const std::runtime_error& e )
+  {
+    err = e.what();
+  }
+  expect(err == "chunk failed", "encode_chunked error");
+  pool.wait(); // the failure stayed out of the pool
+} );
+
+}
@@ -0,0 +1,101 @@
+/*
+* pipeline.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <vector>
+
+namespace RIT::MD
+{
+
+// ---- bounded MPMC queue, producers block while full ----
+template<typename T>
+struct BoundedQueue
+{
+  explicit BoundedQueue(size_t capacity)
+  :
+    cap{ capacity ? capacity : 1 }
+  {
+  }
+
+  // false once closed, v is dropped
+  bool push(T v)
+  {
+    std::unique_lock<std::mutex> lk(m);
+    not_full.wait(lk, [&] { return closed || q.size() < cap; });
+    if( closed )
+      return false;
+    q.push_back(std::move(v));
+    not_empty.notify_one();
+    return true;
+  }
+
+  // false when closed and drained
+  bool pop(T& v)
+  {
+    std::unique_lock<std::mutex> lk(m);
+    not_empty.wait(lk, [&] { return closed || !q.empty(); });
+    if( q.empty() )
+      return false;
+    v = std::move(q.front());
+    q.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+private:
+  std::mutex m;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> q;
+  size_t cap;
+  bool closed = false;
+};
+
+// ---- fixed-size thread pool ----
+struct ThreadPool
+{
+  explicit ThreadPool(size_t threads);
+  ~ThreadPool(); // waits for queued tasks, then joins
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void submit(std::function<void()> task);
+
+  // blocks until every submitted task ran, rethrows the first task exception
+  void wait();
+
+  size_t size() const { return workers.size(); }
+
+private:
+  void run();
+
+  std::vector<std::thread> workers;
+  std::mutex m;
+  std::condition_variable has_task;
+  std::condition_variable idle;
+  std::deque<std::function<void()>> tasks;
+  size_t active = 0;
+  bool stop = false;
+  std::exception_ptr error;
+};
+
+}
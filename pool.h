@@ -0,0 +1,104 @@
+/*
+* pool.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace RIT::MD
+{
+
+// ---- thread-safe pool of re-bindable objects ----
+// acquire(args...) hands out an idle object re-bound with rebind(args...),
+// or a new T(args...) when none is idle; the lease returns it on
+// destruction. Once the idle list has grown to its working size, acquire
+// and release do not allocate.
+template<typename T>
+struct ObjectPool
+{
+  struct Return
+  {
+    ObjectPool* pool = nullptr;
+    void operator()(T* t) const { pool->release(t); }
+  };
+  using Lease = std::unique_ptr<T, Return>;
+
+  explicit ObjectPool(size_t max_idle = 64)
+  :
+    max_idle{ max_idle }
+  {
+    idle.reserve(max_idle);
+  }
+
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  ~ObjectPool()
+  {
+    for( T* t : idle )
+      delete t;
+  }
+
+  template<typename... Args>
+  Lease acquire(Args&&... args)
+  {
+    T* t = nullptr;
+    {
+      std::lock_guard<std::mutex> lk(m);
+      if( !idle.empty() )
+      {
+        t = idle.back();
+        idle.pop_back();
+      }
+    }
+    if( !t )
+      return Lease(new T(std::forward<Args>(args)...), Return{ this });
+
+    try
+    {
+      t->rebind(std::forward<Args>(args)...);
+    }
+    catch( ... )
+    {
+      delete t;
+      throw;
+    }
+    return Lease(t, Return{ this });
+  }
+
+  size_t idle_count() const
+  {
+    std::lock_guard<std::mutex> lk(m);
+    return idle.size();
+  }
+
+private:
+  void release(T* t)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m);
+      if( idle.size() < max_idle )
+      {
+        idle.push_back(t);
+        return;
+      }
+    }
+    delete t;
+  }
+
+  mutable std::mutex m;
+  std::vector<T*> idle;
+  size_t max_idle;
+};
+
+// writers keep their buffer, compressors their ZSTD_CCtx and output buffer
+using WriterPool = ObjectPool<BufferedBitWriter>;
+using CompressorPool = ObjectPool<ZstdStreamCompressor>;
+
+}
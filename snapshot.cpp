@@ -0,0 +1,170 @@
+/*
+* snapshot.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "snapshot.h"
+#include <zstd.h>
+#include <random>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+// the prefix only helps within the window, widen it for large snapshots;
+// the level's hash tables are too small to find matches across MiBs of
+// prefix, long distance matching does
+static void fit_window(ZSTD_CCtx* cctx, size_t prefix)
+{
+  unsigned wlog = 0; // level default
+  if( prefix > (size_t(1) << 20) )
+  {
+    wlog = 64 - unsigned(__builtin_clzll(uint64_t(prefix) * 2 - 1));
+    wlog = std::min(wlog, 27u); // default decoder limit
+  }
+  size_t rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, int(wlog));
+  if( !ZSTD_isError(rc) )
+    rc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, wlog ? 1 : 0);
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+}
+
+SnapshotCompressor::SnapshotCompressor(ISink& downstream, int lvl)
+:
+  z{ downstream, lvl }
+{
+}
+
+void SnapshotCompressor::write(const uint8_t* data, size_t n)
+{
+  cur.insert(cur.end(), data, data + n);
+  z.write(data, n);
+}
+
+void SnapshotCompressor::flush()
+{
+  z.flush();
+}
+
+void SnapshotCompressor::finish()
+{
+  z.finish();
+  prev.swap(cur);
+  cur.clear();
+  ++snapshots;
+  fit_window(z.cctx, prev.size());
+  z.ref_prefix(prev.data(), prev.size());
+}
+
+SnapshotDecompressor::SnapshotDecompressor()
+:
+  out_buf(ZSTD_DStreamOutSize())
+{
+  dctx = ZSTD_createDCtx();
+  if( !dctx )
+    throw std::runtime_error("ZSTD_createDCtx failed");
+}
+
+SnapshotDecompressor::~SnapshotDecompressor()
+{
+  if( dctx )
+    ZSTD_freeDCtx(dctx);
+}
+
+const std::vector<uint8_t>& SnapshotDecompressor::decompress(const uint8_t* frame, size_t n)
+{
+  // drop any state a failed frame left behind, then the prefix
+  size_t rc = ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+  if( !ZSTD_isError(rc) )
+    rc = ZSTD_DCtx_refPrefix(dctx, prev.data(), prev.size());
+  if( ZSTD_isError(rc) )
+    throw std::runtime_error(ZSTD_getErrorName(rc));
+
+  std::vector<uint8_t> cur;
+  cur.reserve(prev.size());
+  ZSTD_inBuffer inb{ frame, n, 0 };
+  do
+  {
+    ZSTD_outBuffer outb{ out_buf.data(), out_buf.size(), 0 };
+    rc = ZSTD_decompressStream(dctx, &outb, &inb);
+    if( ZSTD_isError(rc) )
+      throw std::runtime_error(ZSTD_getErrorName(rc));
+    cur.insert(cur.end(), out_buf.data(), out_buf.data() + outb.pos);
+    if( rc && inb.pos == inb.size && outb.pos < outb.size )
+      throw std::runtime_error("snapshot truncated frame");
+  }
+  while( rc );
+  if( inb.pos != inb.size )
+    throw std::runtime_error("snapshot trailing bytes after frame");
+
+  prev.swap(cur);
+  ++snapshots;
+  return prev;
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+// a chain of slowly changing snapshots decodes in order, later frames
+// cost about their diff, and a reader joining mid-chain is rejected
+static int reg1 = add_test( []()
+{
+  static constexpr size_t kSnapshots = 6;
+  std::mt19937_64 g(74);
+  std::vector<uint8_t> state(200000);
+  for( uint8_t& b : state )
+    b = uint8_t(g());
+
+  std::vector<std::vector<uint8_t>> snaps;
+  std::vector<uint8_t> z;
+  std::vector<size_t> ends;
+  {
+    VectorSink zs(z);
+    SnapshotCompressor c(zs);
+    for( size_t k = 0; k < kSnapshots; ++k )
+    {
+      for( unsigned i = 0; i < 100; ++i )
+        state[g() % state.size()] = uint8_t(g());
+      snaps.push_back(state);
+      for( size_t off = 0; off < state.size(); off += 7000 )
+        c.write(state.data() + off, std::min<size_t>(7000, state.size() - off));
+      c.finish();
+      ends.push_back(z.size());
+    }
+  }
+
+  std::vector<std::pair<const uint8_t*, size_t>> frames;
+  for( size_t off = 0; off < z.size(); )
+  {
+    const size_t n = ZSTD_findFrameCompressedSize(z.data() + off, z.size() - off);
+    expect(!ZSTD_isError(n), "snapshot frame size");
+    frames.emplace_back(z.data() + off, n);
+    off += n;
+    expect(off == ends[frames.size() - 1], "snapshot frame bounds");
+  }
+  expect(frames.size() == kSnapshots, "snapshot frame count");
+  for( size_t k = 1; k < kSnapshots; ++k )
+    expect(frames[k].second < frames[0].second / 20, "snapshot delta size");
+
+  SnapshotDecompressor d;
+  for( size_t k = 0; k < kSnapshots; ++k )
+    expect(d.decompress(frames[k].first, frames[k].second) == snaps[k], "snapshot chain");
+
+  SnapshotDecompressor late;
+  bool threw = false;
+  try
+  {
+    late.decompress(frames[3].first, frames[3].second);
+  }
+  catch( const std::runtime_error& )
+  {
+    threw = true;
+  }
+  expect(threw, "snapshot mid-chain reader");
+} );
+
+}
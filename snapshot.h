@@ -0,0 +1,50 @@
+/*
+* snapshot.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "codec.h"
+
+namespace RIT::MD
+{
+
+// ---- snapshot frames delta-compressed against the previous snapshot ----
+// Each finish() ends one standalone zstd frame whose matches may reach
+// into the previous snapshot's encoded bytes (ZSTD_CCtx_refPrefix), so a
+// snapshot costs about its diff. The reader must see the same frames in
+// the same order.
+struct SnapshotCompressor final : ISink
+{
+  ZstdStreamCompressor z;
+  std::vector<uint8_t> prev; // referenced by the frame in progress
+  std::vector<uint8_t> cur;
+  uint64_t snapshots = 0;
+
+  explicit SnapshotCompressor(ISink& downstream, int lvl = 3);
+
+  void write(const uint8_t* data, size_t n) override;
+  void flush() override;
+  void finish() override; // ends the snapshot frame
+};
+
+struct SnapshotDecompressor
+{
+  ZSTD_DCtx* dctx = nullptr;
+  std::vector<uint8_t> prev; // last decoded snapshot
+  std::vector<uint8_t> out_buf;
+  uint64_t snapshots = 0;
+
+  SnapshotDecompressor();
+  ~SnapshotDecompressor();
+  SnapshotDecompressor(const SnapshotDecompressor&) = delete;
+  SnapshotDecompressor& operator=(const SnapshotDecompressor&) = delete;
+
+  // one whole frame (ZSTD_findFrameCompressedSize splits a concatenation),
+  // returns the snapshot's encoded bytes, valid until the next call
+  const std::vector<uint8_t>& decompress(const uint8_t* frame, size_t n);
+};
+
+}
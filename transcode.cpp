@@ -0,0 +1,313 @@
+/*
+* transcode.cpp
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#include "transcode.h"
+#include <zstd.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include "common/types.h"
+
+namespace RIT::MD
+{
+
+struct TranscodeJob
+{
+  uint64_t seq = 0;
+  std::vector<uint8_t> bytes; // compressed in, then compressed out
+  std::vector<uint8_t> raw;
+  QuoteColumnBuffer cols;
+  size_t n = 0;
+  FrameIndexEntry e;
+  std::vector<BloomLine> lines;
+};
+
+using TranscodeJobPtr = std::unique_ptr<TranscodeJob>;
+
+struct StageCounter
+{
+  std::atomic<uint64_t> items{ 0 };
+  std::atomic<uint64_t> bytes_in{ 0 };
+  std::atomic<uint64_t> bytes_out{ 0 };
+  std::atomic<uint64_t> busy_ns{ 0 };
+
+  void add(size_t in, size_t out, std::chrono::steady_clock::time_point t0)
+  {
+    const auto dt = std::chrono::steady_clock::now() - t0;
+    items.fetch_add(1, std::memory_order_relaxed);
+    bytes_in.fetch_add(in, std::memory_order_relaxed);
+    bytes_out.fetch_add(out, std::memory_order_relaxed);
+    busy_ns.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(dt).count()), std::memory_order_relaxed);
+  }
+
+  StageStats stats() const
+  {
+    return StageStats{ items.load(), bytes_in.load(), bytes_out.load(), double(busy_ns.load()) * 1e-9 };
+  }
+};
+
+// limits frames between the reader and the writer, so the reorder
+// buffer stays bounded
+struct InFlightWindow
+{
+  std::mutex m;
+  std::condition_variable cv;
+  uint64_t written = 0;
+  bool aborted = false;
+
+  bool wait_slot(uint64_t seq, uint64_t window)
+  {
+    std::unique_lock<std::mutex> lk(m);
+    cv.wait(lk, [&] { return aborted || seq < written + window; });
+    return !aborted;
+  }
+
+  void advance()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    ++written;
+    cv.notify_all();
+  }
+
+  bool is_aborted()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    return aborted;
+  }
+
+  void abort()
+  {
+    std::lock_guard<std::mutex> lk(m);
+    aborted = true;
+    cv.notify_all();
+  }
+};
+
+TranscodeStats transcode(SeekableReader& in, SeekableWriter& out, const TranscodeOptions& opt)
+{
+  out.flush_frame();
+
+  const size_t ndec = std::max<size_t>(opt.decode_threads, 1);
+  const size_t nenc = std::max<size_t>(opt.encode_threads, 1);
+  const size_t depth = std::max<size_t>(opt.queue_depth, 1);
+  const uint64_t window = 3 * depth + ndec + nenc;
+
+  BoundedQueue<TranscodeJobPtr> to_decode(depth);
+  BoundedQueue<TranscodeJobPtr> to_encode(depth);
+  BoundedQueue<TranscodeJobPtr> to_write(depth);
+  InFlightWindow win;
+  StageCounter c_read, c_decode, c_encode, c_write;
+  std::atomic<size_t> dec_left{ ndec };
+  std::atomic<size_t> enc_left{ nenc };
+
+  auto abort_all = [&]
+  {
+    win.abort();
+    to_decode.close();
+    to_encode.close();
+    to_write.close();
+  };
+
+  // runs a stage body, any failure unblocks every other stage
+  auto guarded = [&](auto body)
+  {
+    return [&, body]
+    {
+      try
+      {
+        body();
+      }
+      catch( ... )
+      {
+        abort_all();
+        throw;
+      }
+    };
+  };
+
+  const auto wall0 = std::chrono::steady_clock::now();
+  ThreadPool pool(2 + ndec + nenc);
+
+  pool.submit(guarded([&]
+  {
+    for( size_t i = 0; i < in.frames(); ++i )
+    {
+      if( !win.wait_slot(i, window) )
+        return;
+      const auto t0 = std::chrono::steady_clock::now();
+      TranscodeJobPtr job = std::make_unique<TranscodeJob>();
+      job->seq = i;
+      job->bytes.resize(in.index[i].csize);
+      in.src.read(in.index[i].offset, job->bytes.data(), job->bytes.size());
+      c_read.add(job->bytes.size(), job->bytes.size(), t0);
+      if( !to_decode.push(std::move(job)) )
+        return;
+    }
+    to_decode.close();
+  }));
+
+  for( size_t t = 0; t < ndec; ++t )
+    pool.submit(guarded([&]
+    {
+      std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+      if( !dctx )
+        throw std::runtime_error("ZSTD_createDCtx failed");
+      TranscodeJobPtr job;
+      while( to_decode.pop(job) )
+      {
+        const auto t0 = std::chrono::steady_clock::now();
+        decode_frame(dctx.get(), job->bytes.data(), job->bytes.size(), max_block_bytes(in.index[job->seq].records), job->raw);
+        BitReader r(job->raw.data(), job->raw.data() + job->raw.size());
+        job->n = get_block(r, job->cols);
+        c_decode.add(job->bytes.size(), job->raw.size(), t0);
+        if( !to_encode.push(std::move(job)) )
+          return;
+      }
+      if( dec_left.fetch_sub(1) == 1 )
+        to_encode.close();
+    }));
+
+  for( size_t t = 0; t < nenc; ++t )
+    pool.submit(guarded([&]
+    {
+      std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(create_cctx(out.level), ZSTD_freeCCtx);
+      std::vector<uint32_t> keys;
+      TranscodeJobPtr job;
+      while( to_encode.pop(job) )
+      {
+        const auto t0 = std::chrono::steady_clock::now();
+        const size_t n = job->n;
+        const QuoteColumns c = job->cols.columns(n);
+        job->lines.clear();
+        job->e = make_index_entry(c, n, out.bloom_bits_per_key, keys, job->lines);
+        encode_frame(cctx.get(), c, n, out.layout, job->raw, job->bytes);
+        c_encode.add(job->raw.size(), job->bytes.size(), t0);
+        if( !to_write.push(std::move(job)) )
+          return;
+      }
+      if( enc_left.fetch_sub(1) == 1 )
+        to_write.close();
+    }));
+
+  pool.submit(guarded([&]
+  {
+    std::map<uint64_t, TranscodeJobPtr> pending;
+    uint64_t next = 0;
+    TranscodeJobPtr job;
+    while( to_write.pop(job) )
+    {
+      pending.emplace(job->seq, std::move(job));
+      for( auto it = pending.begin(); it != pending.end() && it->first == next; it = pending.erase(it) )
+      {
+        const auto t0 = std::chrono::steady_clock::now();
+        TranscodeJob& j = *it->second;
+        out.append_frame(j.bytes.data(), j.bytes.size(), j.e, j.lines.data());
+        c_write.add(j.bytes.size(), j.bytes.size(), t0);
+        ++next;
+        win.advance();
+      }
+    }
+    // after an abort the failing stage reports the cause
+    if( next != in.frames() && !win.is_aborted() )
+      throw std::runtime_error("transcode lost frames");
+  }));
+
+  pool.wait();
+
+  TranscodeStats st;
+  st.read = c_read.stats();
+  st.decode = c_decode.stats();
+  st.encode = c_encode.stats();
+  st.write = c_write.stats();
+  st.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall0).count();
+  return st;
+}
+
+static void expect(bool ok, const char* what)
+{
+  if( !ok )
+    throw std::runtime_error(what);
+}
+
+static uint64_t tc_ts(size_t i) { return uint64_t(i) * 1000 + i % 3; }
+static uint32_t tc_instr(size_t i) { return uint32_t(i * 7919 % 300); }
+static int64_t tc_px(size_t i) { return 10000 + int64_t(i * 37 % 300) - 150; }
+static uint64_t tc_sz(size_t i) { return i % 10 * 100; }
+
+// Columnar -> Row with more workers than queue slots: every record comes
+// back in order, and a corrupt frame reports the decoder's error
+static int reg1 = add_test( []()
+{
+  static constexpr size_t kRecords = 1000;
+  std::vector<uint8_t> file;
+  {
+    VectorSink vs(file);
+    SeekableWriter w(vs, 97, 1, 0, BlockLayout::Columnar);
+    for( size_t i = 0; i < kRecords; ++i )
+      w.add(tc_ts(i), tc_instr(i), tc_px(i), tc_sz(i));
+    w.finish();
+  }
+
+  const TranscodeOptions opt{ 3, 4, 1 };
+  for( int round = 0; round < 4; ++round )
+  {
+    MemorySource src(file.data(), file.size());
+    SeekableReader in(src);
+    std::vector<uint8_t> res;
+    VectorSink vs(res);
+    SeekableWriter out(vs, 4096, 3, 0, BlockLayout::Row);
+    const TranscodeStats st = transcode(in, out, opt);
+    out.finish();
+    expect(st.write.items == in.frames(), "transcode frame count");
+
+    MemorySource rsrc(res.data(), res.size());
+    SeekableReader r(rsrc);
+    expect(r.frames() == in.frames(), "transcode output frames");
+    const std::vector<uint8_t>& b = r.load_frame(0);
+    BitReader br(b.data(), b.data() + b.size());
+    expect(get_block_header(br).layout == BlockLayout::Row, "transcode layout");
+
+    QuoteColumnBuffer buf;
+    size_t i = 0;
+    for( size_t f = 0; f < r.frames(); ++f )
+    {
+      const size_t n = r.read_frame(f, buf);
+      for( size_t j = 0; j < n; ++j, ++i )
+        expect(buf.ts[j] == tc_ts(i) && buf.instr[j] == tc_instr(i)
+            && buf.px[j] == tc_px(i) && buf.sz[j] == tc_sz(i), "transcode record");
+    }
+    expect(i == kRecords, "transcode record count");
+  }
+
+  // a frame without zstd magic fails in a decode worker
+  std::vector<uint8_t> bad = file;
+  {
+    MemorySource src(bad.data(), bad.size());
+    SeekableReader in(src);
+    std::memset(bad.data() + in.index[5].offset, 0, 4);
+  }
+  for( int round = 0; round < 4; ++round )
+  {
+    MemorySource src(bad.data(), bad.size());
+    SeekableReader in(src);
+    std::vector<uint8_t> res;
+    VectorSink vs(res);
+    SeekableWriter out(vs, 4096, 3, 0, BlockLayout::Row);
+    std::string err;
+    try
+    {
+      transcode(in, out, opt);
+    }
+    catch( const std::exception& e )
+    {
+      err = e.what();
+    }
+    expect(err == "bad container frame", "transcode decode error");
+  }
+} );
+
+}
@@ -0,0 +1,49 @@
+/*
+* transcode.h
+* Author: Mikhail Gorbunov, RIT
+* Copyright(c) 2025. All rights reserved.
+*/
+
+#pragma once
+
+#include "container.h"
+#include "pipeline.h"
+
+namespace RIT::MD
+{
+
+// ---- parallel container transcoder ----
+// read -> decode -> encode -> write, decode and encode run on several
+// workers, bounded queues between stages, frames are written in input
+// order. The output level, layout and Bloom settings come from `out`.
+
+struct TranscodeOptions
+{
+  size_t decode_threads = 2;
+  size_t encode_threads = 2;
+  size_t queue_depth = 8; // frames per queue
+};
+
+struct StageStats
+{
+  uint64_t items = 0;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  double busy_s = 0; // summed over the stage's workers
+
+  double mb_per_s() const { return busy_s > 0 ? double(bytes_in) / busy_s / 1e6 : 0.0; }
+};
+
+struct TranscodeStats
+{
+  StageStats read;
+  StageStats decode;
+  StageStats encode;
+  StageStats write;
+  double wall_s = 0;
+};
+
+// appends every frame of `in` to `out`, does not finish `out`
+TranscodeStats transcode(SeekableReader& in, SeekableWriter& out, const TranscodeOptions& opt = {});
+
+}